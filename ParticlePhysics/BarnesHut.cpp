@@ -0,0 +1,180 @@
+/*
+* Barnes-Hut quadtree for approximate O(n log n) gravity
+* @author Dominick Dimpfel
+* @date 02/05/2024
+*/
+
+#include "BarnesHut.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+void BarnesHut::build(const float* x, const float* y, const float* mass, int count)
+{
+	m_x = x;
+	m_y = y;
+	m_mass = mass;
+	m_count = count;
+
+	m_nodes.clear();
+	m_next.assign(count, -1);
+	if (count == 0)
+		return;
+
+	// Square root cell around every body
+	float minX = x[0], maxX = x[0], minY = y[0], maxY = y[0];
+	for (int i = 1; i < count; i++)
+	{
+		minX = std::min(minX, x[i]);
+		maxX = std::max(maxX, x[i]);
+		minY = std::min(minY, y[i]);
+		maxY = std::max(maxY, y[i]);
+	}
+	float half = std::max(maxX - minX, maxY - minY) * 0.5f + 1.f;
+	m_nodes.push_back(Node{ (minX + maxX) * 0.5f, (minY + maxY) * 0.5f, half, 0.f, 0.f, 0.f, -1, -1 });
+
+	for (int i = 0; i < count; i++)
+	{
+		int node = 0;
+		int depth = 0;
+		while (true)
+		{
+			Node& n = m_nodes[node];
+			if (n.child != -1)
+			{
+				node = n.child + (x[i] >= n.cx) + 2 * (y[i] >= n.cy);
+				depth++;
+				continue;
+			}
+			if (n.body == -1)
+			{
+				n.body = i;
+				break;
+			}
+			// Coincident or nearly coincident bodies share the deepest leaf
+			if (depth >= BARNES_HUT_MAX_DEPTH)
+			{
+				m_next[i] = n.body;
+				n.body = i;
+				break;
+			}
+
+			int existing = n.body;
+			_subdivide(node);
+			Node& split = m_nodes[node];
+			split.body = -1;
+			int q = split.child + (x[existing] >= split.cx) + 2 * (y[existing] >= split.cy);
+			m_nodes[q].body = existing;
+		}
+	}
+
+	_computeMass();
+}
+
+void BarnesHut::_subdivide(int node)
+{
+	int first = static_cast<int>(m_nodes.size());
+	Node parent = m_nodes[node];
+	float q = parent.halfSize * 0.5f;
+
+	// Child order matches quadrant index (x >= cx) + 2 * (y >= cy)
+	m_nodes.push_back(Node{ parent.cx - q, parent.cy - q, q, 0.f, 0.f, 0.f, -1, -1 });
+	m_nodes.push_back(Node{ parent.cx + q, parent.cy - q, q, 0.f, 0.f, 0.f, -1, -1 });
+	m_nodes.push_back(Node{ parent.cx - q, parent.cy + q, q, 0.f, 0.f, 0.f, -1, -1 });
+	m_nodes.push_back(Node{ parent.cx + q, parent.cy + q, q, 0.f, 0.f, 0.f, -1, -1 });
+	m_nodes[node].child = first;
+}
+
+void BarnesHut::_computeMass()
+{
+	// Children are always stored after their parent
+	for (int k = static_cast<int>(m_nodes.size()) - 1; k >= 0; k--)
+	{
+		Node& n = m_nodes[k];
+		float mass = 0.f, mx = 0.f, my = 0.f;
+		if (n.child == -1)
+		{
+			for (int b = n.body; b != -1; b = m_next[b])
+			{
+				mass += m_mass[b];
+				mx += m_mass[b] * m_x[b];
+				my += m_mass[b] * m_y[b];
+			}
+		}
+		else
+		{
+			for (int c = n.child; c < n.child + 4; c++)
+			{
+				const Node& ch = m_nodes[c];
+				mass += ch.mass;
+				mx += ch.mass * ch.comX;
+				my += ch.mass * ch.comY;
+			}
+		}
+
+		n.mass = mass;
+		n.comX = mass > 0.f ? mx / mass : n.cx;
+		n.comY = mass > 0.f ? my / mass : n.cy;
+	}
+}
+
+void BarnesHut::computeForce(int i, float& fx, float& fy) const
+{
+	_accumulate(m_x[i], m_y[i], m_mass[i], i, fx, fy);
+}
+
+void BarnesHut::computeForce(float px, float py, float mass, float& fx, float& fy) const
+{
+	_accumulate(px, py, mass, -1, fx, fy);
+}
+
+void BarnesHut::_accumulate(float px, float py, float mass, int self, float& fx, float& fy) const
+{
+	if (m_nodes.empty())
+		return;
+
+	float theta2 = m_theta * m_theta;
+	int stack[BARNES_HUT_MAX_DEPTH * 3 + 4];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node& n = m_nodes[stack[--top]];
+		if (n.mass == 0.f) continue;
+
+		if (n.child == -1)
+		{
+			for (int b = n.body; b != -1; b = m_next[b])
+			{
+				if (b == self) continue;
+				float dx = m_x[b] - px;
+				float dy = m_y[b] - py;
+				float d2 = dx * dx + dy * dy;
+				// Ignore overlapping particles to avoid infinite force
+				if (d2 < m_epsilon) continue;
+				float f = m_g * mass * m_mass[b] / (d2 * std::sqrt(d2));
+				fx += f * dx;
+				fy += f * dy;
+			}
+			continue;
+		}
+
+		float dx = n.comX - px;
+		float dy = n.comY - py;
+		float d2 = dx * dx + dy * dy;
+		float size = n.halfSize * 2.f;
+		bool inside = std::fabs(px - n.cx) <= n.halfSize && std::fabs(py - n.cy) <= n.halfSize;
+
+		if (!inside && size * size < theta2 * d2)
+		{
+			float f = m_g * mass * n.mass / (d2 * std::sqrt(d2));
+			fx += f * dx;
+			fy += f * dy;
+			continue;
+		}
+
+		for (int c = n.child; c < n.child + 4; c++)
+			stack[top++] = c;
+	}
+}
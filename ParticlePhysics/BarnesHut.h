@@ -0,0 +1,82 @@
+/*
+* Barnes-Hut quadtree for approximate O(n log n) gravity
+* @author Dominick Dimpfel
+* @date 02/05/2024
+*/
+#ifndef BARNESHUT_H
+#define BARNESHUT_H
+#include <vector>
+
+#define BARNES_HUT_MAX_DEPTH	24
+
+class BarnesHut
+{
+private:
+	struct Node
+	{
+		float cx, cy;		// center of square cell
+		float halfSize;
+		float mass;
+		float comX, comY;	// center of mass
+		int child;			// first of four children, -1 for leaf
+		int body;			// first body in leaf, -1 if empty
+	};
+
+	// Node pool, cleared but not freed each build
+	std::vector<Node> m_nodes;
+	// Bodies sharing a max depth leaf are chained through m_next
+	std::vector<int> m_next;
+
+	const float* m_x = nullptr;
+	const float* m_y = nullptr;
+	const float* m_mass = nullptr;
+	int m_count = 0;
+
+	float m_theta;
+	float m_g;
+	float m_epsilon;	// squared distance below which pairs are ignored
+
+public:
+	BarnesHut(float theta, float g, float epsilon) : m_theta(theta), m_g(g), m_epsilon(epsilon) {}
+	~BarnesHut() = default;
+
+	/*
+	* Build tree over count bodies. Arrays must outlive any computeForce call.
+	*/
+	void build(const float* x, const float* y, const float* mass, int count);
+
+	/*
+	* Approximate gravitational force on body i from every other body.
+	* Cells whose size over distance is below theta are treated as a
+	* single mass at their center of mass.
+	*/
+	void computeForce(int i, float& fx, float& fy) const;
+
+	/*
+	* Approximate force on a body of mass at px, py that is not in the tree
+	*/
+	void computeForce(float px, float py, float mass, float& fx, float& fy) const;
+
+	void setTheta(float theta)			{ m_theta = theta; }
+	float getTheta() const				{ return m_theta; }
+
+	int getNodeCount() const			{ return static_cast<int>(m_nodes.size()); }
+
+private:
+	/*
+	* Walk tree accumulating force on point px, py skipping body self
+	*/
+	void _accumulate(float px, float py, float mass, int self, float& fx, float& fy) const;
+
+	/*
+	* Split leaf into four children appended to the pool
+	*/
+	void _subdivide(int node);
+
+	/*
+	* Sum mass and center of mass bottom up
+	*/
+	void _computeMass();
+};
+
+#endif // !BARNESHUT_H
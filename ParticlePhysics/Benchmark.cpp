@@ -0,0 +1,269 @@
+/*
+* Benchmark suite. Steps every scene at several particle counts from a
+* fixed seed and reports the mean time per step of each update phase as
+* csv or json so runs of different builds can be diffed. Several gravity
+* solvers can be run side by side to compare runtime and force error.
+* @author Dominick Dimpfel
+* @date 02/15/2024
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Universe.h"
+#include "Scenes.h"
+
+struct BenchmarkResult
+{
+	std::string scene;
+	std::string solver;
+	int count = 0;
+	int finalCount = 0;
+	int steps = 0;
+	StepTimings mean;
+	double stepsPerSecond = 0.0;
+	double contacts = 0.0;				// mean contact pairs per step
+	double contactsPerSecond = 0.0;		// contact pairs over response time
+	float gravityError = -1.f;	// only measured with --accuracy
+};
+
+static void printUsage()
+{
+	std::cout <<
+		"Usage: ParticlesBenchmark [options]\n"
+		"  --scenes a,b,...             scenes to run (disk,orbits,random)\n"
+		"  --counts n,m,...             particle counts (1000,10000,100000)\n"
+		"  --steps N                    measured steps per run (10)\n"
+		"  --warmup N                   unmeasured steps before timing (2)\n"
+		"  --threads N                  force phase threads (all)\n"
+		"  --solvers a,b,...            gravity solvers, direct|barnes-hut|fmm|pm|p3m|cutoff (direct)\n"
+		"  --theta T                    Barnes-Hut opening angle (" << BARNES_HUT_THETA << ")\n"
+		"  --order N                    FMM expansion order (" << FMM_ORDER << ")\n"
+		"  --mesh N                     particle mesh cells along the longer side (" << PM_MESH_SIZE << ")\n"
+		"  --cutoff R                   neighbour distance of cutoff and p3m gravity (" << GRAV_EFFECT_DISTANCE << ")\n"
+		"  --integrator NAME            euler|leapfrog|yoshida4|block (leapfrog)\n"
+		"  --iterations N               contact solver passes per step (" << CONTACT_ITERATIONS << ")\n"
+		"  --seed S                     random seed (1)\n"
+		"  --fixed-grid                 keep the initial collision cell size\n"
+		"  --accuracy                   also measure solver force error, O(n^2)\n"
+		"  --format csv|json            output format (csv)\n"
+		"  --out FILE                   write results to FILE instead of stdout\n";
+}
+
+static std::vector<std::string> split(const std::string& list)
+{
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ','))
+		if (!item.empty())
+			items.push_back(item);
+	return items;
+}
+
+static void writeCsv(std::ostream& out, const std::vector<BenchmarkResult>& results)
+{
+	out << "scene,solver,count,final_count,steps,broad_ms,narrow_ms,response_ms,gravity_ms,integration_ms,total_ms,steps_per_sec,contacts,contacts_per_sec,gravity_error\n";
+	for (const BenchmarkResult& r : results)
+	{
+		out << r.scene << ',' << r.solver << ',' << r.count << ',' << r.finalCount << ',' << r.steps << ','
+			<< r.mean.broadPhase * 1000.0 << ',' << r.mean.narrowPhase * 1000.0 << ','
+			<< r.mean.response * 1000.0 << ','
+			<< r.mean.gravity * 1000.0 << ',' << r.mean.integration * 1000.0 << ','
+			<< r.mean.total() * 1000.0 << ',' << r.stepsPerSecond << ','
+			<< r.contacts << ',' << r.contactsPerSecond << ',';
+		if (r.gravityError >= 0.f)
+			out << r.gravityError;
+		out << '\n';
+	}
+}
+
+static void writeJson(std::ostream& out, const std::vector<BenchmarkResult>& results,
+	const std::string& integrator, int iterations, int threads, unsigned int seed, SimdLevel simd)
+{
+	out << "{\n"
+		<< "  \"integrator\": \"" << integrator << "\",\n"
+		<< "  \"contact_iterations\": " << iterations << ",\n"
+		<< "  \"threads\": " << threads << ",\n"
+		<< "  \"simd\": \"" << GravityKernel::levelName(simd) << "\",\n"
+		<< "  \"seed\": " << seed << ",\n"
+		<< "  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult& r = results[i];
+		out << "    { \"scene\": \"" << r.scene << "\", \"solver\": \"" << r.solver
+			<< "\", \"count\": " << r.count
+			<< ", \"final_count\": " << r.finalCount << ", \"steps\": " << r.steps
+			<< ", \"broad_ms\": " << r.mean.broadPhase * 1000.0
+			<< ", \"narrow_ms\": " << r.mean.narrowPhase * 1000.0
+			<< ", \"response_ms\": " << r.mean.response * 1000.0
+			<< ", \"gravity_ms\": " << r.mean.gravity * 1000.0
+			<< ", \"integration_ms\": " << r.mean.integration * 1000.0
+			<< ", \"total_ms\": " << r.mean.total() * 1000.0
+			<< ", \"steps_per_sec\": " << r.stepsPerSecond
+			<< ", \"contacts\": " << r.contacts
+			<< ", \"contacts_per_sec\": " << r.contactsPerSecond;
+		if (r.gravityError >= 0.f)
+			out << ", \"gravity_error\": " << r.gravityError;
+		out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<std::string> scenes = { "disk", "orbits", "random" };
+	std::vector<std::string> counts = { "1000", "10000", "100000" };
+	std::vector<std::string> solvers = { "direct" };
+	std::string integrator = "leapfrog";
+	std::string format = "csv";
+	std::string outPath;
+	int steps = 10;
+	int warmup = 2;
+	int threads = static_cast<int>(std::thread::hardware_concurrency());
+	float theta = BARNES_HUT_THETA;
+	int order = FMM_ORDER;
+	int mesh = PM_MESH_SIZE;
+	float cutoff = GRAV_EFFECT_DISTANCE;
+	int iterations = CONTACT_ITERATIONS;
+	unsigned int seed = 1;
+	bool accuracy = false;
+	bool fixedGrid = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--scenes" && hasValue)			scenes = split(argv[++i]);
+		else if (arg == "--counts" && hasValue)		counts = split(argv[++i]);
+		else if (arg == "--steps" && hasValue)		steps = std::atoi(argv[++i]);
+		else if (arg == "--warmup" && hasValue)		warmup = std::atoi(argv[++i]);
+		else if (arg == "--threads" && hasValue)	threads = std::atoi(argv[++i]);
+		else if (arg == "--solvers" && hasValue)	solvers = split(argv[++i]);
+		else if (arg == "--theta" && hasValue)		theta = static_cast<float>(std::atof(argv[++i]));
+		else if (arg == "--order" && hasValue)		order = std::atoi(argv[++i]);
+		else if (arg == "--mesh" && hasValue)		mesh = std::atoi(argv[++i]);
+		else if (arg == "--cutoff" && hasValue)		cutoff = static_cast<float>(std::atof(argv[++i]));
+		else if (arg == "--integrator" && hasValue)	integrator = argv[++i];
+		else if (arg == "--iterations" && hasValue)	iterations = std::atoi(argv[++i]);
+		else if (arg == "--seed" && hasValue)		seed = static_cast<unsigned int>(std::atoi(argv[++i]));
+		else if (arg == "--format" && hasValue)		format = argv[++i];
+		else if (arg == "--out" && hasValue)		outPath = argv[++i];
+		else if (arg == "--accuracy")				accuracy = true;
+		else if (arg == "--fixed-grid")				fixedGrid = true;
+		else
+		{
+			printUsage();
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+	if (steps < 1)
+		steps = 1;
+	Integrator integratorKind;
+	if (!Universe::parseIntegrator(integrator, integratorKind))
+	{
+		std::cerr << "unknown integrator " << integrator << "\n";
+		return 1;
+	}
+	if (!Instrumentation::enabled())
+		std::cerr << "built without PARTICLES_INSTRUMENTATION, phase timings will be zero\n";
+
+	std::vector<BenchmarkResult> results;
+	int usedThreads = 1;
+	SimdLevel simd = SimdLevel::SCALAR;
+
+	for (const std::string& scene : scenes)
+	{
+		for (const std::string& countText : counts)
+		{
+			for (const std::string& solver : solvers)
+			{
+				int count = std::atoi(countText.c_str());
+				GravitySolver gravitySolver;
+				if (!Universe::parseGravitySolver(solver, gravitySolver))
+				{
+					std::cerr << "unknown solver " << solver << "\n";
+					return 1;
+				}
+
+				// Same seed for every run so each scene starts identically across builds
+				srand(seed);
+				Universe u = Universe();
+				u.setThreadCount(threads);
+				u.setGridMode(GridMode::REBUILD);
+				u.setGravitySolver(gravitySolver);
+				u.setIntegrator(integratorKind);
+				u.setBarnesHutTheta(theta);
+				u.setMultipoleOrder(order);
+				u.setMeshSize(mesh);
+				u.setGravityCutoff(cutoff);
+				u.setContactIterations(iterations);
+				u.setGridAutoTune(!fixedGrid);
+				if (!setupNamedScene(u, scene, count))
+				{
+					std::cerr << "unknown scene " << scene << "\n";
+					return 1;
+				}
+				usedThreads = u.getThreadCount();
+				simd = u.getSimdLevel();
+
+				for (int step = 0; step < warmup; step++)
+					u.update(DELTA_TIME);
+
+				BenchmarkResult r;
+				r.scene = scene;
+				r.solver = solver;
+				r.count = count;
+				r.steps = steps;
+
+				auto start = std::chrono::steady_clock::now();
+				for (int step = 0; step < steps; step++)
+				{
+					u.update(DELTA_TIME);
+					const StepTimings& t = u.getLastStepTimings();
+					r.mean.broadPhase += t.broadPhase / steps;
+					r.mean.narrowPhase += t.narrowPhase / steps;
+					r.mean.response += t.response / steps;
+					r.mean.gravity += t.gravity / steps;
+					r.mean.integration += t.integration / steps;
+					r.contacts += static_cast<double>(u.getLastStepStats().contacts) / steps;
+				}
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+				r.finalCount = static_cast<int>(u.getParticles().size());
+				r.stepsPerSecond = seconds > 0.0 ? steps / seconds : 0.0;
+				r.contactsPerSecond = r.mean.response > 0.0 ? r.contacts / r.mean.response : 0.0;
+				if (accuracy)
+					r.gravityError = u.checkGravityAccuracy();
+				results.push_back(r);
+
+				// Progress goes to stderr so stdout stays machine readable
+				std::cerr << scene << " " << count << " " << solver << ": "
+					<< r.mean.gravity * 1000.0 << " ms gravity, " << r.mean.total() * 1000.0 << " ms/step\n";
+			}
+		}
+	}
+
+	std::ofstream file;
+	if (!outPath.empty())
+	{
+		file.open(outPath);
+		if (!file)
+		{
+			std::cerr << "cannot open " << outPath << "\n";
+			return 1;
+		}
+	}
+	std::ostream& out = outPath.empty() ? std::cout : file;
+
+	if (format == "json")
+		writeJson(out, results, integrator, iterations, usedThreads, seed, simd);
+	else
+		writeCsv(out, results);
+	return 0;
+}
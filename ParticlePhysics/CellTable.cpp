@@ -0,0 +1,205 @@
+/*
+* Flat open-addressed hash table mapping integer grid cells to id buckets
+* @author Dominick Dimpfel
+* @date 02/03/2024
+*/
+
+#include "CellTable.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+CellTable::CellTable()
+{
+	m_slots.assign(CELL_TABLE_MIN_CAPACITY, Slot{ 0, -1 });
+	m_mask = CELL_TABLE_MIN_CAPACITY - 1;
+	m_size = 0;
+}
+
+int CellTable::index(int r, int c)
+{
+	// Keep load factor under one half so probe chains stay short
+	if ((m_size + 1) * 2 > static_cast<int>(m_slots.size()))
+		_rehash(m_slots.size() * 2);
+
+	std::int64_t key = _pack(r, c);
+	std::uint64_t i = _hash(key) & m_mask;
+	while (m_slots[i].bucket != -1)
+	{
+		if (m_slots[i].key == key)
+			return m_slots[i].bucket;
+		i = (i + 1) & m_mask;
+	}
+
+	m_slots[i].key = key;
+	m_slots[i].bucket = m_size++;
+	if (static_cast<int>(m_keys.size()) < m_size)
+	{
+		m_keys.push_back(key);
+		m_heads.push_back(-1);
+		m_counts.push_back(0);
+	}
+	else
+	{
+		m_keys[m_size - 1] = key;
+		m_heads[m_size - 1] = -1;
+		m_counts[m_size - 1] = 0;
+	}
+	return m_slots[i].bucket;
+}
+
+int CellTable::findIndex(int r, int c) const
+{
+	std::int64_t slot = _findSlot(_pack(r, c));
+	return slot == -1 ? -1 : m_slots[slot].bucket;
+}
+
+void CellTable::insert(int r, int c, int id)
+{
+	int cell = index(r, c);
+
+	int entry = m_freeEntry;
+	if (entry != -1)
+		m_freeEntry = m_entries[entry].next;
+	else
+	{
+		entry = static_cast<int>(m_entries.size());
+		m_entries.push_back(Entry());
+	}
+	m_entries[entry].id = id;
+	m_entries[entry].next = m_heads[cell];
+	m_heads[cell] = entry;
+	m_counts[cell]++;
+}
+
+bool CellTable::remove(int r, int c, int id)
+{
+	std::int64_t found = _findSlot(_pack(r, c));
+	if (found == -1)
+		return false;
+
+	int cell = m_slots[found].bucket;
+	int* link = &m_heads[cell];
+	while (*link != -1 && m_entries[*link].id != id)
+		link = &m_entries[*link].next;
+	if (*link == -1)
+		return false;
+
+	int entry = *link;
+	*link = m_entries[entry].next;
+	m_entries[entry].next = m_freeEntry;
+	m_freeEntry = entry;
+
+	// Reclaim empty cells so the table only holds occupied ones
+	if (--m_counts[cell] == 0)
+		_eraseSlot(static_cast<std::uint64_t>(found));
+	return true;
+}
+
+void CellTable::erase(int r, int c)
+{
+	std::int64_t found = _findSlot(_pack(r, c));
+	if (found == -1)
+		return;
+
+	// Splice the whole bucket onto the free list
+	int cell = m_slots[found].bucket;
+	if (m_heads[cell] != -1)
+	{
+		int tail = m_heads[cell];
+		while (m_entries[tail].next != -1)
+			tail = m_entries[tail].next;
+		m_entries[tail].next = m_freeEntry;
+		m_freeEntry = m_heads[cell];
+	}
+	_eraseSlot(static_cast<std::uint64_t>(found));
+}
+
+void CellTable::_eraseSlot(std::uint64_t i)
+{
+	int dense = m_slots[i].bucket;
+
+	// Backward shift deletion, pull later entries of the probe chain into
+	// the hole unless their home slot lies cyclically in (i, j]
+	std::uint64_t j = i;
+	for (;;)
+	{
+		j = (j + 1) & m_mask;
+		if (m_slots[j].bucket == -1)
+			break;
+
+		std::uint64_t home = _hash(m_slots[j].key) & m_mask;
+		bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+		if (stays) continue;
+
+		m_slots[i] = m_slots[j];
+		i = j;
+	}
+	m_slots[i].bucket = -1;
+
+	// Move the last cell into the freed dense index
+	int last = m_size - 1;
+	if (dense != last)
+	{
+		m_keys[dense] = m_keys[last];
+		m_heads[dense] = m_heads[last];
+		m_counts[dense] = m_counts[last];
+		m_slots[_findSlot(m_keys[dense])].bucket = dense;
+	}
+	m_size--;
+
+	_shrink(m_size);
+}
+
+void CellTable::clear()
+{
+	for (Slot& s : m_slots)
+		s.bucket = -1;
+	m_entries.clear();
+	m_freeEntry = -1;
+
+	// Sized for the cells just cleared since a rebuild refills about as many
+	int previous = m_size;
+	m_size = 0;
+	_shrink(previous);
+}
+
+std::int64_t CellTable::_findSlot(std::int64_t key) const
+{
+	std::uint64_t i = _hash(key) & m_mask;
+	while (m_slots[i].bucket != -1)
+	{
+		if (m_slots[i].key == key)
+			return static_cast<std::int64_t>(i);
+		i = (i + 1) & m_mask;
+	}
+	return -1;
+}
+
+void CellTable::_rehash(std::size_t capacity)
+{
+	std::vector<Slot> old;
+	old.swap(m_slots);
+	m_slots.assign(capacity, Slot{ 0, -1 });
+	m_mask = m_slots.size() - 1;
+
+	for (const Slot& s : old)
+	{
+		if (s.bucket == -1) continue;
+		std::uint64_t i = _hash(s.key) & m_mask;
+		while (m_slots[i].bucket != -1)
+			i = (i + 1) & m_mask;
+		m_slots[i] = s;
+	}
+}
+
+void CellTable::_shrink(int live)
+{
+	// Halve at a load factor of one eighth so the table does not thrash
+	// between growing and shrinking
+	std::size_t capacity = m_slots.size();
+	while (capacity > CELL_TABLE_MIN_CAPACITY && static_cast<std::size_t>(live) * 8 < capacity)
+		capacity /= 2;
+	if (capacity != m_slots.size())
+		_rehash(capacity);
+}
@@ -0,0 +1,172 @@
+/*
+* Flat open-addressed hash table mapping integer grid cells to id buckets.
+* Cells can be erased so the table only holds occupied cells. Bucket
+* entries of every cell are linked nodes in one shared arena with a free
+* list, so moving ids between cells never allocates once the arena has
+* grown to the peak number of entries.
+* @author Dominick Dimpfel
+* @date 02/03/2024
+*/
+#ifndef CELLTABLE_H
+#define CELLTABLE_H
+#include <cstdint>
+#include <vector>
+
+#define CELL_TABLE_MIN_CAPACITY		64
+
+class CellTable
+{
+private:
+	struct Slot
+	{
+		std::int64_t key;
+		int bucket;		// -1 when slot is empty
+	};
+
+	struct Entry
+	{
+		int id;
+		int next;		// next entry of the same cell or free entry, -1 ends
+	};
+
+	std::vector<Slot> m_slots;
+	std::vector<std::int64_t> m_keys;	// packed cell of every dense index
+	std::vector<int> m_heads;			// first entry of every dense index
+	std::vector<int> m_counts;
+	std::vector<Entry> m_entries;
+	int m_freeEntry = -1;
+	std::uint64_t m_mask;
+	int m_size;
+
+	static std::int64_t _pack(int r, int c)
+	{
+		// Shift unsigned since negative rows are valid cells
+		std::uint64_t key = (static_cast<std::uint64_t>(static_cast<std::uint32_t>(r)) << 32) | static_cast<std::uint32_t>(c);
+		return static_cast<std::int64_t>(key);
+	}
+
+	static std::uint64_t _hash(std::int64_t key)
+	{
+		std::uint64_t h = static_cast<std::uint64_t>(key);
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+public:
+	/*
+	* Ids of one cell, most recently inserted first
+	*/
+	class Bucket
+	{
+	private:
+		const Entry* m_entries;
+		int m_head;
+		int m_size;
+
+	public:
+		class Iterator
+		{
+		private:
+			const Entry* m_entries;
+			int m_entry;
+
+		public:
+			Iterator(const Entry* entries, int entry) : m_entries(entries), m_entry(entry) {}
+
+			int operator*() const			{ return m_entries[m_entry].id; }
+			Iterator& operator++()			{ m_entry = m_entries[m_entry].next; return *this; }
+			bool operator != (const Iterator& rs) const { return m_entry != rs.m_entry; }
+		};
+
+		Bucket(const Entry* entries, int head, int size) : m_entries(entries), m_head(head), m_size(size) {}
+
+		Iterator begin() const				{ return Iterator(m_entries, m_head); }
+		Iterator end() const				{ return Iterator(m_entries, -1); }
+		int size() const					{ return m_size; }
+		bool empty() const					{ return m_size == 0; }
+	};
+
+	CellTable();
+	~CellTable() = default;
+
+	/*
+	* Find dense index of cell r, c creating it if the cell is new.
+	* Indices run from 0 to size() - 1 and are stable until a cell is
+	* erased or the table cleared.
+	* @return index of cell
+	*/
+	int index(int r, int c);
+
+	/*
+	* Find dense index of cell r, c without creating it
+	* @return index of cell or -1 if cell was never used
+	*/
+	int findIndex(int r, int c) const;
+
+	/*
+	* Add id to cell r, c creating the cell if it is new
+	*/
+	void insert(int r, int c, int id);
+
+	/*
+	* Take id out of cell r, c and erase the cell once it is empty
+	* @return false if id was not in the cell
+	*/
+	bool remove(int r, int c, int id);
+
+	/*
+	* Remove cell r, c. The last cell takes over its dense index and the
+	* entries of the cell go back to the arena.
+	*/
+	void erase(int r, int c);
+
+	/*
+	* Bucket of the cell with dense index i
+	*/
+	Bucket bucket(int i) const		{ return Bucket(m_entries.data(), m_heads[i], m_counts[i]); }
+
+	/*
+	* Row and column of the cell with dense index i
+	*/
+	void cellOf(int i, int& r, int& c) const
+	{
+		r = static_cast<int>(static_cast<std::uint32_t>(static_cast<std::uint64_t>(m_keys[i]) >> 32));
+		c = static_cast<int>(static_cast<std::uint32_t>(m_keys[i]));
+	}
+
+	/*
+	* Forget every cell, the entry arena keeps its capacity
+	*/
+	void clear();
+
+	/*
+	* Number of cells in the table
+	*/
+	int size() const { return m_size; }
+
+private:
+	/*
+	* Slot of cell key or -1 if the cell is not in the table
+	*/
+	std::int64_t _findSlot(std::int64_t key) const;
+
+	/*
+	* Resize slot array to capacity and reinsert all used cells
+	*/
+	void _rehash(std::size_t capacity);
+
+	/*
+	* Erase the cell in slot i whose bucket is already empty
+	*/
+	void _eraseSlot(std::uint64_t i);
+
+	/*
+	* Shrink slots to fit live cells so memory follows the occupied cells
+	* and not every cell ever visited
+	*/
+	void _shrink(int live);
+};
+
+#endif // !CELLTABLE_H
@@ -0,0 +1,41 @@
+/*
+* Union-find over dense indices
+* @author Dominick Dimpfel
+* @date 02/26/2024
+*/
+
+#include "DisjointSet.h"
+#include <vector>
+#include <numeric>
+
+void DisjointSet::reset(int count)
+{
+	m_parent.resize(count);
+	std::iota(m_parent.begin(), m_parent.end(), 0);
+}
+
+int DisjointSet::find(int i)
+{
+	while (m_parent[i] != i)
+	{
+		m_parent[i] = m_parent[m_parent[i]];
+		i = m_parent[i];
+	}
+	return i;
+}
+
+bool DisjointSet::unite(int a, int b)
+{
+	a = find(a);
+	b = find(b);
+	if (a == b)
+		return false;
+
+	// Smaller root wins instead of union by rank so roots are canonical,
+	// path halving keeps the trees shallow enough for merge groups
+	if (b < a)
+		m_parent[a] = b;
+	else
+		m_parent[b] = a;
+	return true;
+}
@@ -0,0 +1,39 @@
+/*
+* Union-find over dense indices. Every set is rooted at its smallest
+* index, so the roots only depend on which pairs were joined and not on
+* the order they were joined in.
+* @author Dominick Dimpfel
+* @date 02/26/2024
+*/
+#ifndef DISJOINTSET_H
+#define DISJOINTSET_H
+#include <vector>
+
+class DisjointSet
+{
+private:
+	std::vector<int> m_parent;
+
+public:
+	DisjointSet() = default;
+	~DisjointSet() = default;
+
+	/*
+	* Make count singleton sets, keeps the storage
+	*/
+	void reset(int count);
+
+	/*
+	* Root of the set holding i, halves the path on the way up
+	*/
+	int find(int i);
+
+	/*
+	* Join the sets of a and b, returns false if they already were one
+	*/
+	bool unite(int a, int b);
+
+	int size() const		{ return static_cast<int>(m_parent.size()); }
+};
+
+#endif // !DISJOINTSET_H
@@ -0,0 +1,469 @@
+/*
+* Fast multipole method for O(n) gravity on an adaptive quadtree
+* @author Dominick Dimpfel
+* @date 02/18/2024
+*/
+
+#include "FastMultipole.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include "ThreadPool.h"
+
+// Multipoles are unnormalized moments Q_n = sum m * d^n of body offsets d
+// from the expansion center, locals are Taylor coefficients L_k of the
+// potential around the target center. For a multi-index n = (a, b),
+// d^n = dx^a * dy^b and C(n, k) = C(a, k.a) * C(b, k.b).
+
+FastMultipole::FastMultipole(int order, float theta, float g, float epsilon)
+{
+	m_theta = theta;
+	m_g = g;
+	m_epsilon = epsilon;
+	setOrder(order);
+}
+
+void FastMultipole::setOrder(int order)
+{
+	m_order = std::max(1, std::min(order, FMM_MAX_ORDER));
+	m_terms = (m_order + 1) * (m_order + 2) / 2;
+
+	int size = m_order + 1;
+	m_binomial.assign(size * size, 0.0);
+	for (int n = 0; n < size; n++)
+	{
+		m_binomial[n * size] = 1.0;
+		for (int k = 1; k <= n; k++)
+			m_binomial[n * size + k] = m_binomial[(n - 1) * size + k - 1] + m_binomial[(n - 1) * size + k];
+	}
+
+	// L_k += (-1)^|n| * C(n + k, n) * Q_n * D_(n + k) for |n| + |k| <= order
+	m_translations.clear();
+	for (int dk = 0; dk <= m_order; dk++)
+	{
+		for (int kb = 0; kb <= dk; kb++)
+		{
+			int ka = dk - kb;
+			for (int dn = 0; dn + dk <= m_order; dn++)
+			{
+				for (int nb = 0; nb <= dn; nb++)
+				{
+					int na = dn - nb;
+					double sign = dn % 2 ? -1.0 : 1.0;
+					double coef = sign * _binomial(na + ka, na) * _binomial(nb + kb, nb);
+					m_translations.push_back(Translation{ _term(ka, kb), _term(na, nb), _term(na + ka, nb + kb), coef });
+				}
+			}
+		}
+	}
+}
+
+void FastMultipole::build(const float* x, const float* y, const float* mass, int count)
+{
+	m_nodes.clear();
+	m_tasks.clear();
+	m_index.resize(count);
+	for (int i = 0; i < count; i++)
+		m_index[i] = i;
+	if (count == 0)
+		return;
+
+	// Square root cell around every body
+	float minX = x[0], maxX = x[0], minY = y[0], maxY = y[0];
+	for (int i = 1; i < count; i++)
+	{
+		minX = std::min(minX, x[i]);
+		maxX = std::max(maxX, x[i]);
+		minY = std::min(minY, y[i]);
+		maxY = std::max(maxY, y[i]);
+	}
+
+	Node root{};
+	root.boxX = (minX + maxX) * 0.5f;
+	root.boxY = (minY + maxY) * 0.5f;
+	root.halfSize = std::max(maxX - minX, maxY - minY) * 0.5f + 1.f;
+	root.first = 0;
+	root.count = count;
+	std::fill(root.child, root.child + 4, -1);
+	root.leaf = true;
+	m_nodes.push_back(root);
+
+	// Children are appended so every parent comes before its children
+	for (int node = 0; node < static_cast<int>(m_nodes.size()); node++)
+		_subdivide(node, x, y);
+
+	m_px.resize(count);
+	m_py.resize(count);
+	m_pm.resize(count);
+	for (int k = 0; k < count; k++)
+	{
+		m_px[k] = x[m_index[k]];
+		m_py[k] = y[m_index[k]];
+		m_pm[k] = mass[m_index[k]];
+	}
+
+	for (int node = 0; node < static_cast<int>(m_nodes.size()); node++)
+	{
+		const Node& n = m_nodes[node];
+		if (n.depth == FMM_TASK_DEPTH || (n.leaf && n.depth < FMM_TASK_DEPTH))
+			m_tasks.push_back(node);
+	}
+
+	_upward();
+}
+
+void FastMultipole::_subdivide(int node, const float* x, const float* y)
+{
+	// Copy since pushing children can move the pool
+	Node n = m_nodes[node];
+	if (n.count <= FMM_LEAF_SIZE || n.depth >= FMM_MAX_DEPTH)
+		return;
+
+	// Quadrant index (x >= cx) + 2 * (y >= cy) like BarnesHut
+	int* begin = m_index.data() + n.first;
+	int* end = begin + n.count;
+	int* midY = std::partition(begin, end, [&](int i) { return y[i] < n.boxY; });
+	int* midLow = std::partition(begin, midY, [&](int i) { return x[i] < n.boxX; });
+	int* midHigh = std::partition(midY, end, [&](int i) { return x[i] < n.boxX; });
+	int* bounds[5] = { begin, midLow, midY, midHigh, end };
+
+	float q = n.halfSize * 0.5f;
+	m_nodes[node].leaf = false;
+	for (int c = 0; c < 4; c++)
+	{
+		int count = static_cast<int>(bounds[c + 1] - bounds[c]);
+		if (count == 0) continue;
+
+		Node child{};
+		child.boxX = n.boxX + (c & 1 ? q : -q);
+		child.boxY = n.boxY + (c & 2 ? q : -q);
+		child.halfSize = q;
+		child.first = static_cast<int>(bounds[c] - m_index.data());
+		child.count = count;
+		std::fill(child.child, child.child + 4, -1);
+		child.depth = n.depth + 1;
+		child.leaf = true;
+
+		m_nodes[node].child[c] = static_cast<int>(m_nodes.size());
+		m_nodes.push_back(child);
+	}
+}
+
+void FastMultipole::_upward()
+{
+	m_multipoles.assign(m_nodes.size() * m_terms, 0.0);
+	double powX[FMM_MAX_ORDER + 1], powY[FMM_MAX_ORDER + 1];
+
+	for (int node = static_cast<int>(m_nodes.size()) - 1; node >= 0; node--)
+	{
+		Node& n = m_nodes[node];
+		double* q = &m_multipoles[node * m_terms];
+
+		// Mass and center of mass from bodies or children
+		double mass = 0.0, sumX = 0.0, sumY = 0.0;
+		if (n.leaf)
+		{
+			for (int k = n.first; k < n.first + n.count; k++)
+			{
+				mass += m_pm[k];
+				sumX += static_cast<double>(m_pm[k]) * m_px[k];
+				sumY += static_cast<double>(m_pm[k]) * m_py[k];
+			}
+		}
+		else
+		{
+			for (int c : n.child)
+			{
+				if (c == -1) continue;
+				const Node& child = m_nodes[c];
+				mass += child.mass;
+				sumX += child.mass * child.cx;
+				sumY += child.mass * child.cy;
+			}
+		}
+		n.mass = static_cast<float>(mass);
+		n.cx = mass > 0.0 ? sumX / mass : n.boxX;
+		n.cy = mass > 0.0 ? sumY / mass : n.boxY;
+
+		if (n.leaf)
+		{
+			// P2M, exact radius from the bodies
+			n.radius = 0.0;
+			for (int k = n.first; k < n.first + n.count; k++)
+			{
+				double dx = m_px[k] - n.cx, dy = m_py[k] - n.cy;
+				n.radius = std::max(n.radius, std::sqrt(dx * dx + dy * dy));
+
+				powX[0] = powY[0] = 1.0;
+				for (int p = 1; p <= m_order; p++)
+				{
+					powX[p] = powX[p - 1] * dx;
+					powY[p] = powY[p - 1] * dy;
+				}
+				for (int d = 0; d <= m_order; d++)
+					for (int b = 0; b <= d; b++)
+						q[_term(d - b, b)] += m_pm[k] * powX[d - b] * powY[b];
+			}
+			continue;
+		}
+
+		// M2M, radius bounded by children and by the farthest cell corner
+		double radius = 0.0;
+		for (int c : n.child)
+		{
+			if (c == -1) continue;
+			const Node& child = m_nodes[c];
+			const double* cq = &m_multipoles[c * m_terms];
+			double sx = child.cx - n.cx, sy = child.cy - n.cy;
+			radius = std::max(radius, child.radius + std::sqrt(sx * sx + sy * sy));
+
+			powX[0] = powY[0] = 1.0;
+			for (int p = 1; p <= m_order; p++)
+			{
+				powX[p] = powX[p - 1] * sx;
+				powY[p] = powY[p - 1] * sy;
+			}
+			for (int d = 0; d <= m_order; d++)
+			{
+				for (int b = 0; b <= d; b++)
+				{
+					int a = d - b;
+					double sum = 0.0;
+					for (int ka = 0; ka <= a; ka++)
+						for (int kb = 0; kb <= b; kb++)
+							sum += _binomial(a, ka) * _binomial(b, kb) * cq[_term(ka, kb)] * powX[a - ka] * powY[b - kb];
+					q[_term(a, b)] += sum;
+				}
+			}
+		}
+		double cornerX = std::abs(n.cx - n.boxX) + n.halfSize;
+		double cornerY = std::abs(n.cy - n.boxY) + n.halfSize;
+		n.radius = std::min(radius, std::sqrt(cornerX * cornerX + cornerY * cornerY));
+	}
+}
+
+void FastMultipole::computeForces(ThreadPool& pool, float* fx, float* fy)
+{
+	int count = static_cast<int>(m_index.size());
+	if (count == 0)
+		return;
+
+	m_fx.assign(count, 0.f);
+	m_fy.assign(count, 0.f);
+	m_locals.assign(m_nodes.size() * m_terms, 0.0);
+
+	// Tasks own disjoint subtrees so threads never write the same local or
+	// body. Dealt round robin since subtrees differ in size.
+	int tasks = static_cast<int>(m_tasks.size());
+	int threads = pool.size();
+	pool.run([&](int t)
+	{
+		for (int k = t; k < tasks; k += threads)
+		{
+			_interact(m_tasks[k]);
+			_downward(m_tasks[k]);
+		}
+	});
+
+	for (int k = 0; k < count; k++)
+	{
+		fx[m_index[k]] += m_fx[k];
+		fy[m_index[k]] += m_fy[k];
+	}
+}
+
+void FastMultipole::_interact(int target)
+{
+	std::vector<std::pair<int, int>> stack;
+	std::vector<double> derivatives(m_terms);
+	double theta2 = static_cast<double>(m_theta) * m_theta;
+
+	// Every (target, source) pair splits into pairs of children until the
+	// cells are far enough apart or both are leaves
+	stack.emplace_back(target, 0);
+	while (!stack.empty())
+	{
+		std::pair<int, int> pair = stack.back();
+		stack.pop_back();
+		int a = pair.first, b = pair.second;
+		const Node& na = m_nodes[a];
+		const Node& nb = m_nodes[b];
+
+		if (a == b)
+		{
+			if (na.leaf)
+			{
+				_direct(a, a);
+				continue;
+			}
+			for (int ca : na.child)
+			{
+				if (ca == -1) continue;
+				for (int cb : na.child)
+					if (cb != -1)
+						stack.emplace_back(ca, cb);
+			}
+			continue;
+		}
+
+		double dx = na.cx - nb.cx, dy = na.cy - nb.cy;
+		double reach = na.radius + nb.radius;
+		if (reach * reach < theta2 * (dx * dx + dy * dy))
+		{
+			_multipoleToLocal(b, a, derivatives);
+			continue;
+		}
+
+		if (na.leaf && nb.leaf)
+		{
+			_direct(b, a);
+			continue;
+		}
+
+		// Split the bigger cell
+		if (!na.leaf && (nb.leaf || na.radius >= nb.radius))
+		{
+			for (int ca : na.child)
+				if (ca != -1)
+					stack.emplace_back(ca, b);
+		}
+		else
+		{
+			for (int cb : nb.child)
+				if (cb != -1)
+					stack.emplace_back(a, cb);
+		}
+	}
+}
+
+void FastMultipole::_multipoleToLocal(int source, int target, std::vector<double>& derivatives)
+{
+	const Node& s = m_nodes[source];
+	const Node& t = m_nodes[target];
+	double rx = t.cx - s.cx, ry = t.cy - s.cy;
+	double r2 = rx * rx + ry * ry;
+	double* d = derivatives.data();
+
+	// Taylor coefficients of 1 / |r| from the recurrence
+	// |m| r^2 d_m + (2|m| - 1) (rx d_(m-ex) + ry d_(m-ey)) + (|m| - 1) (d_(m-2ex) + d_(m-2ey)) = 0
+	double invR2 = 1.0 / r2;
+	d[0] = std::sqrt(invR2);
+	for (int deg = 1; deg <= m_order; deg++)
+	{
+		for (int b = 0; b <= deg; b++)
+		{
+			int a = deg - b;
+			double sum = 0.0;
+			if (a > 0) sum += (2 * deg - 1) * rx * d[_term(a - 1, b)];
+			if (b > 0) sum += (2 * deg - 1) * ry * d[_term(a, b - 1)];
+			if (a > 1) sum += (deg - 1) * d[_term(a - 2, b)];
+			if (b > 1) sum += (deg - 1) * d[_term(a, b - 2)];
+			d[_term(a, b)] = -sum * invR2 / deg;
+		}
+	}
+
+	const double* q = &m_multipoles[source * m_terms];
+	double* l = &m_locals[target * m_terms];
+	for (const Translation& tr : m_translations)
+		l[tr.k] += tr.coef * q[tr.n] * d[tr.m];
+}
+
+void FastMultipole::_direct(int source, int target)
+{
+	const Node& s = m_nodes[source];
+	const Node& t = m_nodes[target];
+	for (int i = t.first; i < t.first + t.count; i++)
+	{
+		float xi = m_px[i], yi = m_py[i];
+		float sumX = 0.f, sumY = 0.f;
+		for (int j = s.first; j < s.first + s.count; j++)
+		{
+			float rx = m_px[j] - xi;
+			float ry = m_py[j] - yi;
+			float d = rx * rx + ry * ry;
+
+			// Ignore overlapping particles to avoid infinite force
+			if (d < m_epsilon) continue;
+
+			float f = m_pm[j] / (d * std::sqrt(d));
+			sumX += rx * f;
+			sumY += ry * f;
+		}
+		m_fx[i] += m_g * m_pm[i] * sumX;
+		m_fy[i] += m_g * m_pm[i] * sumY;
+	}
+}
+
+void FastMultipole::_downward(int root)
+{
+	double powX[FMM_MAX_ORDER + 1], powY[FMM_MAX_ORDER + 1];
+	std::vector<int> stack;
+	stack.push_back(root);
+	while (!stack.empty())
+	{
+		int node = stack.back();
+		stack.pop_back();
+		const Node& n = m_nodes[node];
+		const double* l = &m_locals[node * m_terms];
+
+		if (n.leaf)
+		{
+			// L2P, gradient of the local Taylor series at each body
+			for (int k = n.first; k < n.first + n.count; k++)
+			{
+				double tx = m_px[k] - n.cx, ty = m_py[k] - n.cy;
+				powX[0] = powY[0] = 1.0;
+				for (int p = 1; p <= m_order; p++)
+				{
+					powX[p] = powX[p - 1] * tx;
+					powY[p] = powY[p - 1] * ty;
+				}
+
+				double gradX = 0.0, gradY = 0.0;
+				for (int d = 1; d <= m_order; d++)
+				{
+					for (int b = 0; b <= d; b++)
+					{
+						int a = d - b;
+						double coef = l[_term(a, b)];
+						if (a > 0) gradX += a * coef * powX[a - 1] * powY[b];
+						if (b > 0) gradY += b * coef * powX[a] * powY[b - 1];
+					}
+				}
+				m_fx[k] += static_cast<float>(m_g * m_pm[k] * gradX);
+				m_fy[k] += static_cast<float>(m_g * m_pm[k] * gradY);
+			}
+			continue;
+		}
+
+		// L2L, L'_j = sum over k >= j of C(k, j) L_k s^(k - j)
+		for (int c : n.child)
+		{
+			if (c == -1) continue;
+			const Node& child = m_nodes[c];
+			double* cl = &m_locals[c * m_terms];
+			double sx = child.cx - n.cx, sy = child.cy - n.cy;
+
+			powX[0] = powY[0] = 1.0;
+			for (int p = 1; p <= m_order; p++)
+			{
+				powX[p] = powX[p - 1] * sx;
+				powY[p] = powY[p - 1] * sy;
+			}
+			for (int dj = 0; dj <= m_order; dj++)
+			{
+				for (int jb = 0; jb <= dj; jb++)
+				{
+					int ja = dj - jb;
+					double sum = 0.0;
+					for (int ka = ja; ka <= m_order; ka++)
+						for (int kb = jb; ka + kb <= m_order; kb++)
+							sum += _binomial(ka, ja) * _binomial(kb, jb) * l[_term(ka, kb)] * powX[ka - ja] * powY[kb - jb];
+					cl[_term(ja, jb)] += sum;
+				}
+			}
+			stack.push_back(c);
+		}
+	}
+}
@@ -0,0 +1,132 @@
+/*
+* Fast multipole method for O(n) gravity on an adaptive quadtree.
+* The force here falls off as 1 / r^2, which is the gradient of a 1 / r
+* potential. That potential is not harmonic in 2D, so the complex
+* logarithm expansions of the classic 2D FMM do not apply. Cartesian
+* Taylor expansions of 1 / r are used instead. Their derivatives come from
+* a recurrence so any order can be evaluated.
+* @author Dominick Dimpfel
+* @date 02/18/2024
+*/
+#ifndef FASTMULTIPOLE_H
+#define FASTMULTIPOLE_H
+#include <vector>
+#include "ThreadPool.h"
+
+#define FMM_ORDER			6
+#define FMM_MAX_ORDER		12
+#define FMM_THETA			0.5f
+#define FMM_LEAF_SIZE		64
+#define FMM_MAX_DEPTH		24
+#define FMM_TASK_DEPTH		3 // Subtrees at this depth are handed to threads
+
+class FastMultipole
+{
+private:
+	struct Node
+	{
+		double cx, cy;			// center of mass, also the expansion center
+		double radius;			// bound on distance from center to any body
+		float boxX, boxY;		// center of square cell
+		float halfSize;
+		float mass;
+		int first, count;		// bodies m_index[first] to m_index[first + count - 1]
+		int child[4];			// -1 for missing quadrants
+		int depth;
+		bool leaf;
+	};
+
+	// One M2L product, local k gets coef * multipole n * derivative m
+	struct Translation
+	{
+		int k, n, m;
+		double coef;
+	};
+
+	std::vector<Node> m_nodes;
+	std::vector<int> m_index;		// tree order to body index
+	std::vector<int> m_tasks;		// disjoint subtrees covering every body
+
+	// Bodies and their forces in tree order so leaves are contiguous
+	std::vector<float> m_px, m_py, m_pm;
+	std::vector<float> m_fx, m_fy;
+
+	// m_terms coefficients per node
+	std::vector<double> m_multipoles;
+	std::vector<double> m_locals;
+
+	int m_order;
+	int m_terms;
+	std::vector<double> m_binomial;		// (order + 1)^2 table
+	std::vector<Translation> m_translations;
+
+	float m_theta;
+	float m_g;
+	float m_epsilon;	// squared distance below which pairs are ignored
+
+public:
+	FastMultipole(int order, float theta, float g, float epsilon);
+	~FastMultipole() = default;
+
+	/*
+	* Build tree and multipole expansions over count bodies
+	*/
+	void build(const float* x, const float* y, const float* mass, int count);
+
+	/*
+	* Add the force on every body of the last build to fx, fy.
+	* Subtrees are split across pool, the result does not depend on the
+	* thread count.
+	*/
+	void computeForces(ThreadPool& pool, float* fx, float* fy);
+
+	/*
+	* Expansion order of the potential, the force is one order lower.
+	* Clamped to 1 to FMM_MAX_ORDER.
+	*/
+	void setOrder(int order);
+	int getOrder() const				{ return m_order; }
+
+	/*
+	* Opening criterion, two cells interact through expansions when the sum
+	* of their radii is below theta times their distance. Must be below 1.
+	*/
+	void setTheta(float theta)			{ m_theta = theta; }
+	float getTheta() const				{ return m_theta; }
+
+	int getNodeCount() const			{ return static_cast<int>(m_nodes.size()); }
+
+private:
+	int _term(int a, int b) const		{ return (a + b) * (a + b + 1) / 2 + b; }
+	double _binomial(int n, int k) const	{ return m_binomial[n * (m_order + 1) + k]; }
+
+	/*
+	* Split node into up to four children while it holds too many bodies
+	*/
+	void _subdivide(int node, const float* x, const float* y);
+
+	/*
+	* Mass, center, radius and multipoles bottom up
+	*/
+	void _upward();
+
+	/*
+	* Dual tree walk adding every interaction of sources in the whole tree
+	* with targets in subtree target
+	*/
+	void _interact(int target);
+
+	/*
+	* Push locals down subtree root and evaluate them at its bodies
+	*/
+	void _downward(int root);
+
+	void _multipoleToLocal(int source, int target, std::vector<double>& derivatives);
+
+	/*
+	* Direct sum of forces on bodies of target from bodies of source
+	*/
+	void _direct(int source, int target);
+};
+
+#endif // !FASTMULTIPOLE_H
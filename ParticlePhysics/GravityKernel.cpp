@@ -0,0 +1,371 @@
+/*
+* Direct sum gravity kernels over packed float arrays.
+* @author Dominick Dimpfel
+* @date 02/12/2024
+*/
+
+#include "GravityKernel.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define GRAVITY_KERNEL_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang need per function targets to use AVX2 without -mavx2
+#if defined(GRAVITY_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define TARGET_AVX2
+#endif
+
+static void rowScalar(int a, int n, const float* x, const float* y, const float* mass,
+	float g, float epsilon, float* fx, float* fy)
+{
+	float ax = x[a], ay = y[a];
+	float gm = g * mass[a];
+	float sumX = 0.f, sumY = 0.f;
+	for (int b = a + 1; b < n; b++)
+	{
+		float rx = ax - x[b];
+		float ry = ay - y[b];
+		float d = rx * rx + ry * ry;
+
+		// Ignore overlapping particles to avoid infinite force
+		if (d < epsilon) continue;
+
+		float f = gm * mass[b] / (d * std::sqrt(d));
+		fx[b] += rx * f;
+		fy[b] += ry * f;
+		sumX -= rx * f;
+		sumY -= ry * f;
+	}
+	fx[a] += sumX;
+	fy[a] += sumY;
+}
+
+static void targetScalar(int a, int n, const float* x, const float* y, const float* mass,
+	float g, float epsilon, float& fx, float& fy)
+{
+	float ax = x[a], ay = y[a];
+	float gm = g * mass[a];
+	float sumX = 0.f, sumY = 0.f;
+	for (int b = 0; b < n; b++)
+	{
+		float rx = x[b] - ax;
+		float ry = y[b] - ay;
+		float d = rx * rx + ry * ry;
+
+		// Also skips a itself
+		if (d < epsilon) continue;
+
+		float f = gm * mass[b] / (d * std::sqrt(d));
+		sumX += rx * f;
+		sumY += ry * f;
+	}
+	fx += sumX;
+	fy += sumY;
+}
+
+#ifdef GRAVITY_KERNEL_X86
+static void rowSSE(int a, int n, const float* x, const float* y, const float* mass,
+	float g, float epsilon, float* fx, float* fy)
+{
+	const __m128 ax = _mm_set1_ps(x[a]);
+	const __m128 ay = _mm_set1_ps(y[a]);
+	const __m128 gm = _mm_set1_ps(g * mass[a]);
+	const __m128 eps = _mm_set1_ps(epsilon);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 threeHalves = _mm_set1_ps(1.5f);
+	__m128 sumX = _mm_setzero_ps();
+	__m128 sumY = _mm_setzero_ps();
+
+	int b = a + 1;
+	for (; b + 4 <= n; b += 4)
+	{
+		__m128 rx = _mm_sub_ps(ax, _mm_loadu_ps(x + b));
+		__m128 ry = _mm_sub_ps(ay, _mm_loadu_ps(y + b));
+		__m128 d = _mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry));
+		__m128 keep = _mm_cmpge_ps(d, eps);
+
+		// 1 / sqrt(d) refined once with Newton, inv * (1.5 - 0.5 * d * inv * inv)
+		__m128 inv = _mm_rsqrt_ps(d);
+		inv = _mm_mul_ps(inv, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, d), _mm_mul_ps(inv, inv))));
+		__m128 inv3 = _mm_mul_ps(inv, _mm_mul_ps(inv, inv));
+
+		// Masking also clears the NaN produced by overlapping pairs
+		__m128 f = _mm_and_ps(_mm_mul_ps(_mm_mul_ps(gm, _mm_loadu_ps(mass + b)), inv3), keep);
+		__m128 px = _mm_mul_ps(rx, f);
+		__m128 py = _mm_mul_ps(ry, f);
+
+		_mm_storeu_ps(fx + b, _mm_add_ps(_mm_loadu_ps(fx + b), px));
+		_mm_storeu_ps(fy + b, _mm_add_ps(_mm_loadu_ps(fy + b), py));
+		sumX = _mm_sub_ps(sumX, px);
+		sumY = _mm_sub_ps(sumY, py);
+	}
+
+	float lanesX[4], lanesY[4];
+	_mm_storeu_ps(lanesX, sumX);
+	_mm_storeu_ps(lanesY, sumY);
+	float totalX = (lanesX[0] + lanesX[1]) + (lanesX[2] + lanesX[3]);
+	float totalY = (lanesY[0] + lanesY[1]) + (lanesY[2] + lanesY[3]);
+
+	for (; b < n; b++)
+	{
+		float rx = x[a] - x[b];
+		float ry = y[a] - y[b];
+		float d = rx * rx + ry * ry;
+		if (d < epsilon) continue;
+		float f = g * mass[a] * mass[b] / (d * std::sqrt(d));
+		fx[b] += rx * f;
+		fy[b] += ry * f;
+		totalX -= rx * f;
+		totalY -= ry * f;
+	}
+	fx[a] += totalX;
+	fy[a] += totalY;
+}
+
+static void targetSSE(int a, int n, const float* x, const float* y, const float* mass,
+	float g, float epsilon, float& fx, float& fy)
+{
+	const __m128 ax = _mm_set1_ps(x[a]);
+	const __m128 ay = _mm_set1_ps(y[a]);
+	const __m128 gm = _mm_set1_ps(g * mass[a]);
+	const __m128 eps = _mm_set1_ps(epsilon);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 threeHalves = _mm_set1_ps(1.5f);
+	__m128 sumX = _mm_setzero_ps();
+	__m128 sumY = _mm_setzero_ps();
+
+	int b = 0;
+	for (; b + 4 <= n; b += 4)
+	{
+		__m128 rx = _mm_sub_ps(_mm_loadu_ps(x + b), ax);
+		__m128 ry = _mm_sub_ps(_mm_loadu_ps(y + b), ay);
+		__m128 d = _mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry));
+		__m128 keep = _mm_cmpge_ps(d, eps);
+
+		__m128 inv = _mm_rsqrt_ps(d);
+		inv = _mm_mul_ps(inv, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, d), _mm_mul_ps(inv, inv))));
+		__m128 inv3 = _mm_mul_ps(inv, _mm_mul_ps(inv, inv));
+
+		// Masking clears a itself and overlapping pairs
+		__m128 f = _mm_and_ps(_mm_mul_ps(_mm_mul_ps(gm, _mm_loadu_ps(mass + b)), inv3), keep);
+		sumX = _mm_add_ps(sumX, _mm_mul_ps(rx, f));
+		sumY = _mm_add_ps(sumY, _mm_mul_ps(ry, f));
+	}
+
+	float lanesX[4], lanesY[4];
+	_mm_storeu_ps(lanesX, sumX);
+	_mm_storeu_ps(lanesY, sumY);
+	float totalX = (lanesX[0] + lanesX[1]) + (lanesX[2] + lanesX[3]);
+	float totalY = (lanesY[0] + lanesY[1]) + (lanesY[2] + lanesY[3]);
+
+	for (; b < n; b++)
+	{
+		float rx = x[b] - x[a];
+		float ry = y[b] - y[a];
+		float d = rx * rx + ry * ry;
+		if (d < epsilon) continue;
+		float f = g * mass[a] * mass[b] / (d * std::sqrt(d));
+		totalX += rx * f;
+		totalY += ry * f;
+	}
+	fx += totalX;
+	fy += totalY;
+}
+
+TARGET_AVX2
+static void rowAVX2(int a, int n, const float* x, const float* y, const float* mass,
+	float g, float epsilon, float* fx, float* fy)
+{
+	const __m256 ax = _mm256_set1_ps(x[a]);
+	const __m256 ay = _mm256_set1_ps(y[a]);
+	const __m256 gm = _mm256_set1_ps(g * mass[a]);
+	const __m256 eps = _mm256_set1_ps(epsilon);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 threeHalves = _mm256_set1_ps(1.5f);
+	__m256 sumX = _mm256_setzero_ps();
+	__m256 sumY = _mm256_setzero_ps();
+
+	int b = a + 1;
+	for (; b + 8 <= n; b += 8)
+	{
+		__m256 rx = _mm256_sub_ps(ax, _mm256_loadu_ps(x + b));
+		__m256 ry = _mm256_sub_ps(ay, _mm256_loadu_ps(y + b));
+		__m256 d = _mm256_fmadd_ps(rx, rx, _mm256_mul_ps(ry, ry));
+		__m256 keep = _mm256_cmp_ps(d, eps, _CMP_GE_OQ);
+
+		// 1 / sqrt(d) refined once with Newton, inv * (1.5 - 0.5 * d * inv * inv)
+		__m256 inv = _mm256_rsqrt_ps(d);
+		inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, d), _mm256_mul_ps(inv, inv), threeHalves));
+		__m256 inv3 = _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv));
+
+		// Masking also clears the NaN produced by overlapping pairs
+		__m256 f = _mm256_and_ps(_mm256_mul_ps(_mm256_mul_ps(gm, _mm256_loadu_ps(mass + b)), inv3), keep);
+		__m256 px = _mm256_mul_ps(rx, f);
+		__m256 py = _mm256_mul_ps(ry, f);
+
+		_mm256_storeu_ps(fx + b, _mm256_add_ps(_mm256_loadu_ps(fx + b), px));
+		_mm256_storeu_ps(fy + b, _mm256_add_ps(_mm256_loadu_ps(fy + b), py));
+		sumX = _mm256_sub_ps(sumX, px);
+		sumY = _mm256_sub_ps(sumY, py);
+	}
+
+	float lanesX[8], lanesY[8];
+	_mm256_storeu_ps(lanesX, sumX);
+	_mm256_storeu_ps(lanesY, sumY);
+	float totalX = 0.f, totalY = 0.f;
+	for (int k = 0; k < 8; k++)
+	{
+		totalX += lanesX[k];
+		totalY += lanesY[k];
+	}
+
+	for (; b < n; b++)
+	{
+		float rx = x[a] - x[b];
+		float ry = y[a] - y[b];
+		float d = rx * rx + ry * ry;
+		if (d < epsilon) continue;
+		float f = g * mass[a] * mass[b] / (d * std::sqrt(d));
+		fx[b] += rx * f;
+		fy[b] += ry * f;
+		totalX -= rx * f;
+		totalY -= ry * f;
+	}
+	fx[a] += totalX;
+	fy[a] += totalY;
+}
+
+TARGET_AVX2
+static void targetAVX2(int a, int n, const float* x, const float* y, const float* mass,
+	float g, float epsilon, float& fx, float& fy)
+{
+	const __m256 ax = _mm256_set1_ps(x[a]);
+	const __m256 ay = _mm256_set1_ps(y[a]);
+	const __m256 gm = _mm256_set1_ps(g * mass[a]);
+	const __m256 eps = _mm256_set1_ps(epsilon);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 threeHalves = _mm256_set1_ps(1.5f);
+	__m256 sumX = _mm256_setzero_ps();
+	__m256 sumY = _mm256_setzero_ps();
+
+	int b = 0;
+	for (; b + 8 <= n; b += 8)
+	{
+		__m256 rx = _mm256_sub_ps(_mm256_loadu_ps(x + b), ax);
+		__m256 ry = _mm256_sub_ps(_mm256_loadu_ps(y + b), ay);
+		__m256 d = _mm256_fmadd_ps(rx, rx, _mm256_mul_ps(ry, ry));
+		__m256 keep = _mm256_cmp_ps(d, eps, _CMP_GE_OQ);
+
+		__m256 inv = _mm256_rsqrt_ps(d);
+		inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, d), _mm256_mul_ps(inv, inv), threeHalves));
+		__m256 inv3 = _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv));
+
+		// Masking clears a itself and overlapping pairs
+		__m256 f = _mm256_and_ps(_mm256_mul_ps(_mm256_mul_ps(gm, _mm256_loadu_ps(mass + b)), inv3), keep);
+		sumX = _mm256_fmadd_ps(rx, f, sumX);
+		sumY = _mm256_fmadd_ps(ry, f, sumY);
+	}
+
+	float lanesX[8], lanesY[8];
+	_mm256_storeu_ps(lanesX, sumX);
+	_mm256_storeu_ps(lanesY, sumY);
+	float totalX = 0.f, totalY = 0.f;
+	for (int k = 0; k < 8; k++)
+	{
+		totalX += lanesX[k];
+		totalY += lanesY[k];
+	}
+
+	for (; b < n; b++)
+	{
+		float rx = x[b] - x[a];
+		float ry = y[b] - y[a];
+		float d = rx * rx + ry * ry;
+		if (d < epsilon) continue;
+		float f = g * mass[a] * mass[b] / (d * std::sqrt(d));
+		totalX += rx * f;
+		totalY += ry * f;
+	}
+	fx += totalX;
+	fy += totalY;
+}
+#endif // GRAVITY_KERNEL_X86
+
+GravityKernel::GravityKernel(float g, float epsilon)
+{
+	m_g = g;
+	m_epsilon = epsilon;
+	setLevel(detectLevel());
+}
+
+void GravityKernel::setLevel(SimdLevel level)
+{
+	SimdLevel supported = detectLevel();
+	if (static_cast<int>(level) > static_cast<int>(supported))
+		level = supported;
+
+	m_level = level;
+	switch (m_level)
+	{
+#ifdef GRAVITY_KERNEL_X86
+	case SimdLevel::AVX2:	m_row = rowAVX2; m_target = targetAVX2; break;
+	case SimdLevel::SSE:	m_row = rowSSE; m_target = targetSSE; break;
+#endif
+	default:				m_row = rowScalar; m_target = targetScalar; break;
+	}
+}
+
+SimdLevel GravityKernel::detectLevel()
+{
+#if !defined(GRAVITY_KERNEL_X86)
+	return SimdLevel::SCALAR;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+
+	bool avx2 = false;
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+
+	// The OS must save ymm registers on context switch
+	bool ymmEnabled = osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+
+	if (avx2 && fma && ymmEnabled)
+		return SimdLevel::AVX2;
+	return sse2 ? SimdLevel::SSE : SimdLevel::SCALAR;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return SimdLevel::AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SimdLevel::SSE;
+	return SimdLevel::SCALAR;
+#endif
+}
+
+const char* GravityKernel::levelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX2:	return "avx2";
+	case SimdLevel::SSE:	return "sse";
+	default:				return "scalar";
+	}
+}
@@ -0,0 +1,70 @@
+/*
+* Direct sum gravity kernels over packed float arrays.
+* SSE evaluates 4 and AVX2 8 pairs at a time with rsqrt plus one Newton
+* step, the scalar kernel is the exact fallback. The widest kernel the
+* cpu supports is picked at runtime.
+* @author Dominick Dimpfel
+* @date 02/12/2024
+*/
+#ifndef GRAVITYKERNEL_H
+#define GRAVITYKERNEL_H
+
+enum class SimdLevel
+{
+	SCALAR,
+	SSE,
+	AVX2
+};
+
+class GravityKernel
+{
+private:
+	typedef void (*RowFunction)(int a, int n, const float* x, const float* y, const float* mass,
+		float g, float epsilon, float* fx, float* fy);
+	typedef void (*TargetFunction)(int a, int n, const float* x, const float* y, const float* mass,
+		float g, float epsilon, float& fx, float& fy);
+
+	SimdLevel m_level;
+	RowFunction m_row;
+	TargetFunction m_target;
+	float m_g;
+	float m_epsilon;	// squared distance below which pairs are ignored
+
+public:
+	GravityKernel(float g, float epsilon);
+	~GravityKernel() = default;
+
+	/*
+	* Symmetric forces between body a and every body after it up to n.
+	* Force on b is added to fx[b], fy[b] and the opposite sum to fx[a], fy[a].
+	*/
+	void row(int a, int n, const float* x, const float* y, const float* mass, float* fx, float* fy) const
+	{
+		m_row(a, n, x, y, mass, m_g, m_epsilon, fx, fy);
+	}
+
+	/*
+	* Force on body a from every other body below n added to fx, fy.
+	* One sided so a subset of bodies can be updated on its own.
+	*/
+	void target(int a, int n, const float* x, const float* y, const float* mass, float& fx, float& fy) const
+	{
+		m_target(a, n, x, y, mass, m_g, m_epsilon, fx, fy);
+	}
+
+	/*
+	* Use level if the cpu supports it, otherwise the best supported level
+	* below it
+	*/
+	void setLevel(SimdLevel level);
+	SimdLevel getLevel() const				{ return m_level; }
+
+	/*
+	* Widest level supported by the cpu and operating system
+	*/
+	static SimdLevel detectLevel();
+
+	static const char* levelName(SimdLevel level);
+};
+
+#endif // !GRAVITYKERNEL_H
@@ -0,0 +1,309 @@
+/*
+* Headless batch runner. Steps a scene for a number of frames at a fixed
+* DELTA_TIME without a window and reports throughput.
+* @author Dominick Dimpfel
+* @date 02/14/2024
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Universe.h"
+#include "Scenes.h"
+#include "TrajectoryRecorder.h"
+#include "ParticleBatch.h"
+#include "SimulationThread.h"
+
+#define PIPELINE_STALL_SECONDS	10.0 // --pipeline-check fails when no step ends for this long
+
+static void printUsage()
+{
+	std::cout <<
+		"Usage: ParticlesHeadless [options]\n"
+		"  --scene NAME                 disk|orbits|random|procedural, procedural is\n"
+		"                               generated in parallel (disk)\n"
+		"  --count N                    particles (" << UNIVERSE_CAPACITY << ")\n"
+		"  --steps N                    frames to step (1000)\n"
+		"  --threads N                  force phase threads (all)\n"
+		"  --solver NAME                direct|barnes-hut|fmm|pm|p3m|cutoff (direct)\n"
+		"  --theta T                    Barnes-Hut opening angle (" << BARNES_HUT_THETA << ")\n"
+		"  --order N                    FMM expansion order (" << FMM_ORDER << ")\n"
+		"  --mesh N                     particle mesh cells along the longer side (" << PM_MESH_SIZE << ")\n"
+		"  --cutoff R                   neighbour distance of cutoff and p3m gravity (" << GRAV_EFFECT_DISTANCE << ")\n"
+		"  --integrator NAME            euler|leapfrog|yoshida4|block (leapfrog)\n"
+		"  --iterations N               contact solver passes per step (" << CONTACT_ITERATIONS << ")\n"
+		"  --grid incremental|rebuild   collision grid mode (rebuild)\n"
+		"  --seed S                     random seed (1)\n"
+		"  --load FILE                  resume a snapshot instead of generating the scene,\n"
+		"                               its solver settings replace the ones above\n"
+		"  --save FILE                  write a snapshot after the last step\n"
+		"  --record FILE                write trajectories to FILE on a background thread\n"
+		"  --record-every N             steps between recorded frames (1)\n"
+		"  --encoding f32|f16|delta     trajectory column encoding (f32)\n"
+		"  --draw points|quads|circles  fill the window's vertex batch into a CPU buffer\n"
+		"                               every step and time it\n"
+		"  --pipeline                   step on a simulation thread while this thread renders\n"
+		"                               the latest frame every --render-ms\n"
+		"  --render-ms N                render frame time of --pipeline (16)\n"
+		"  --pipeline-check             hold the first frame for the whole run and fail unless\n"
+		"                               the simulation still finishes without waiting on it\n"
+		"  --stats                      dump per step timers and counters\n";
+}
+
+int main(int argc, char** argv)
+{
+	std::string scene = "disk";
+	std::string solver = "direct";
+	std::string integrator = "leapfrog";
+	std::string grid = "rebuild";
+	int count = UNIVERSE_CAPACITY;
+	int steps = 1000;
+	int threads = static_cast<int>(std::thread::hardware_concurrency());
+	float theta = BARNES_HUT_THETA;
+	int order = FMM_ORDER;
+	int mesh = PM_MESH_SIZE;
+	float cutoff = GRAV_EFFECT_DISTANCE;
+	int iterations = CONTACT_ITERATIONS;
+	unsigned int seed = 1;
+	std::string loadPath;
+	std::string savePath;
+	std::string recordPath;
+	std::string encoding = "f32";
+	int recordEvery = 1;
+	std::string draw;
+	bool pipeline = false;
+	bool pipelineCheck = false;
+	int renderMs = 16;
+	bool stats = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--scene" && hasValue)			scene = argv[++i];
+		else if (arg == "--count" && hasValue)		count = std::atoi(argv[++i]);
+		else if (arg == "--steps" && hasValue)		steps = std::atoi(argv[++i]);
+		else if (arg == "--threads" && hasValue)	threads = std::atoi(argv[++i]);
+		else if (arg == "--solver" && hasValue)		solver = argv[++i];
+		else if (arg == "--theta" && hasValue)		theta = static_cast<float>(std::atof(argv[++i]));
+		else if (arg == "--order" && hasValue)		order = std::atoi(argv[++i]);
+		else if (arg == "--mesh" && hasValue)		mesh = std::atoi(argv[++i]);
+		else if (arg == "--cutoff" && hasValue)		cutoff = static_cast<float>(std::atof(argv[++i]));
+		else if (arg == "--integrator" && hasValue)	integrator = argv[++i];
+		else if (arg == "--iterations" && hasValue)	iterations = std::atoi(argv[++i]);
+		else if (arg == "--grid" && hasValue)		grid = argv[++i];
+		else if (arg == "--seed" && hasValue)		seed = static_cast<unsigned int>(std::atoi(argv[++i]));
+		else if (arg == "--load" && hasValue)		loadPath = argv[++i];
+		else if (arg == "--save" && hasValue)		savePath = argv[++i];
+		else if (arg == "--record" && hasValue)		recordPath = argv[++i];
+		else if (arg == "--record-every" && hasValue)	recordEvery = std::atoi(argv[++i]);
+		else if (arg == "--encoding" && hasValue)	encoding = argv[++i];
+		else if (arg == "--draw" && hasValue)		draw = argv[++i];
+		else if (arg == "--pipeline")				pipeline = true;
+		else if (arg == "--render-ms" && hasValue)	renderMs = std::atoi(argv[++i]);
+		else if (arg == "--pipeline-check")			pipeline = pipelineCheck = true;
+		else if (arg == "--stats")					stats = true;
+		else
+		{
+			printUsage();
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+
+	srand(seed);
+
+	Universe u = Universe();
+	u.setThreadCount(threads);
+	u.setGridMode(grid == "incremental" ? GridMode::INCREMENTAL : GridMode::REBUILD);
+	u.setBarnesHutTheta(theta);
+	u.setMultipoleOrder(order);
+	u.setMeshSize(mesh);
+	u.setGravityCutoff(cutoff);
+	u.setContactIterations(iterations);
+
+	GravitySolver gravitySolver;
+	Integrator integratorKind;
+	if (!Universe::parseGravitySolver(solver, gravitySolver) ||
+		!Universe::parseIntegrator(integrator, integratorKind))
+	{
+		printUsage();
+		return 1;
+	}
+	u.setGravitySolver(gravitySolver);
+	u.setIntegrator(integratorKind);
+
+	if (!loadPath.empty())
+	{
+		auto loadStart = std::chrono::steady_clock::now();
+		if (!u.loadSnapshot(loadPath))
+		{
+			std::cerr << "cannot load snapshot " << loadPath << "\n";
+			return 1;
+		}
+		std::cout << "loaded     " << loadPath << " in "
+			<< std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count() << " s\n";
+		scene = loadPath;
+		count = static_cast<int>(u.getParticles().size());
+	}
+	else
+	{
+		auto setupStart = std::chrono::steady_clock::now();
+		if (!setupNamedScene(u, scene, count))
+		{
+			printUsage();
+			return 1;
+		}
+		std::cout << "created    " << u.getParticles().size() << " particles in "
+			<< std::chrono::duration<double>(std::chrono::steady_clock::now() - setupStart).count() << " s\n";
+	}
+
+	TrajectoryRecorder recorder;
+	if (!recordPath.empty())
+	{
+		TrajectoryEncoding trajectoryEncoding;
+		if (!TrajectoryRecorder::parseEncoding(encoding, trajectoryEncoding))
+		{
+			printUsage();
+			return 1;
+		}
+		if (!recorder.open(recordPath, trajectoryEncoding, recordEvery))
+		{
+			std::cerr << "cannot write trajectories to " << recordPath << "\n";
+			return 1;
+		}
+	}
+
+	ParticleBatch batch;
+	BatchShape batchShape = BatchShape::CIRCLES;
+	if (!draw.empty() && !ParticleBatch::parseShape(draw, batchShape))
+	{
+		printUsage();
+		return 1;
+	}
+	batch.setShape(batchShape);
+	std::vector<BatchVertex> vertices;
+	double drawSeconds = 0.0;
+
+	SimulationThread simulation(u);
+	long long framesDrawn = 0;
+	std::string pipelineError;
+	double seconds = 0.0;
+	if (pipeline)
+	{
+		simulation.setOnStep([&recorder](const Universe& su) { recorder.record(su.getStepCount(), su.getStore()); });
+		simulation.start(DELTA_TIME, 0, steps);
+		if (pipelineCheck)
+		{
+			// A renderer that never lets go of its frame must not slow the
+			// simulation down, let alone stop it
+			simulation.acquire();
+			RenderFrame held = simulation.frame();
+			long long lastSteps = -1;
+			auto lastProgress = std::chrono::steady_clock::now();
+			while (!simulation.isFinished())
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				auto now = std::chrono::steady_clock::now();
+				if (simulation.getSteps() != lastSteps)
+				{
+					lastSteps = simulation.getSteps();
+					lastProgress = now;
+				}
+				else if (std::chrono::duration<double>(now - lastProgress).count() > PIPELINE_STALL_SECONDS)
+				{
+					pipelineError = "simulation stalled at step " + std::to_string(lastSteps);
+					break;
+				}
+			}
+			const RenderFrame& front = simulation.frame();
+			if (pipelineError.empty() && (front.step != held.step || front.x != held.x || front.y != held.y))
+				pipelineError = "held frame was written by the simulation";
+			framesDrawn = 1;
+		}
+		else
+		{
+			while (!simulation.isFinished())
+			{
+				if (simulation.acquire())
+				{
+					framesDrawn++;
+					if (!draw.empty())
+					{
+						auto drawStart = std::chrono::steady_clock::now();
+						batch.fill(simulation.frame(), vertices);
+						drawSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - drawStart).count();
+					}
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(renderMs));
+			}
+		}
+		simulation.stop();
+		seconds = simulation.getSeconds();
+		if (pipelineError.empty() && simulation.getSteps() != steps)
+			pipelineError = "simulation took " + std::to_string(simulation.getSteps()) + " of " + std::to_string(steps) + " steps";
+	}
+	else
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int step = 0; step < steps; step++)
+		{
+			u.update(DELTA_TIME);
+			recorder.record(u.getStepCount(), u.getStore());
+			if (!draw.empty())
+			{
+				auto drawStart = std::chrono::steady_clock::now();
+				batch.fill(u.getStore(), vertices);
+				drawSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - drawStart).count();
+			}
+		}
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	std::cout << "scene      " << scene << "\n"
+		<< "particles  " << count << " -> " << u.getParticles().size() << "\n"
+		<< "threads    " << u.getThreadCount() << "\n"
+		<< "solver     " << Universe::gravitySolverName(u.getGravitySolver()) << "\n"
+		<< "integrator " << Universe::integratorName(u.getIntegrator()) << "\n"
+		<< "simd       " << GravityKernel::levelName(u.getSimdLevel()) << "\n"
+		<< "steps      " << steps << "\n"
+		<< "seconds    " << seconds << "\n"
+		<< "steps/sec  " << (seconds > 0.0 ? steps / seconds : 0.0) << "\n";
+	long long drawnFrames = pipeline ? framesDrawn : steps;
+	if (!draw.empty())
+		std::cout << "drawn      " << vertices.size() << " " << ParticleBatch::shapeName(batchShape)
+			<< " vertices, " << (drawnFrames > 0 ? drawSeconds * 1000.0 / drawnFrames : 0.0) << " ms/frame\n";
+	if (pipeline)
+		std::cout << "pipeline   " << simulation.getFramesPublished() << " published, " << framesDrawn << " rendered, "
+			<< simulation.getFramesOverwritten() << " overwritten, max publish "
+			<< simulation.getMaxPublishSeconds() * 1000.0 << " ms\n";
+	if (!pipelineError.empty())
+	{
+		std::cerr << "pipeline check failed: " << pipelineError << "\n";
+		return 1;
+	}
+	if (recorder.isOpen())
+	{
+		bool written = recorder.close();
+		std::cout << "recorded   " << recorder.getFramesWritten() << " frames, "
+			<< recorder.getFramesDropped() << " dropped, " << recorder.getBytesWritten() << " bytes ("
+			<< encoding << ")\n";
+		if (!written)
+		{
+			std::cerr << "trajectory write to " << recordPath << " failed\n";
+			return 1;
+		}
+	}
+	if (stats)
+		u.dumpInstrumentation(std::cout);
+
+	if (!savePath.empty() && !u.saveSnapshot(savePath))
+	{
+		std::cerr << "cannot write snapshot " << savePath << "\n";
+		return 1;
+	}
+	return 0;
+}
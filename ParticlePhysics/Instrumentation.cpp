@@ -0,0 +1,171 @@
+/*
+* Lightweight per step timers and counters for Universe::update
+* @author Dominick Dimpfel
+* @date 02/16/2024
+*/
+
+#include "Instrumentation.h"
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+void Instrumentation::endStep()
+{
+	if (static_cast<int>(m_history.size()) < INSTRUMENTATION_HISTORY)
+	{
+		m_history.push_back(m_current);
+		return;
+	}
+	m_history[m_head] = m_current;
+	m_head = (m_head + 1) % INSTRUMENTATION_HISTORY;
+}
+
+const StepStats& Instrumentation::last() const
+{
+	static const StepStats EMPTY;
+	if (m_history.empty())
+		return EMPTY;
+	return history(historySize() - 1);
+}
+
+const StepStats& Instrumentation::history(int i) const
+{
+	// Until the ring wraps the oldest step is at 0, afterwards at m_head
+	return m_history[(m_head + i) % m_history.size()];
+}
+
+StepStats Instrumentation::average() const
+{
+	StepStats mean;
+	if (m_history.empty())
+		return mean;
+
+	for (const StepStats& s : m_history)
+	{
+		mean.time.broadPhase += s.time.broadPhase;
+		mean.time.narrowPhase += s.time.narrowPhase;
+		mean.time.response += s.time.response;
+		mean.time.gravity += s.time.gravity;
+		mean.time.integration += s.time.integration;
+		mean.candidatePairs += s.candidatePairs;
+		mean.contacts += s.contacts;
+		mean.coalescences += s.coalescences;
+		mean.contactBatches += s.contactBatches;
+		mean.cellMigrations += s.cellMigrations;
+		mean.gravityTargets += s.gravityTargets;
+	}
+
+	double n = static_cast<double>(m_history.size());
+	long long count = static_cast<long long>(m_history.size());
+	mean.time.broadPhase /= n;
+	mean.time.narrowPhase /= n;
+	mean.time.response /= n;
+	mean.time.gravity /= n;
+	mean.time.integration /= n;
+	mean.candidatePairs /= count;
+	mean.contacts /= count;
+	mean.coalescences /= count;
+	mean.contactBatches /= count;
+	mean.cellMigrations /= count;
+	mean.gravityTargets /= count;
+	return mean;
+}
+
+void Instrumentation::clear()
+{
+	m_current = StepStats();
+	m_history.clear();
+	m_head = 0;
+}
+
+void Instrumentation::dump(std::ostream& out) const
+{
+	if (!enabled())
+	{
+		out << "instrumentation disabled at compile time\n";
+		return;
+	}
+	if (m_history.empty())
+	{
+		out << "no steps recorded\n";
+		return;
+	}
+
+	struct Metric
+	{
+		const char* name;
+		double scale;	// seconds are shown as milliseconds
+		double (*get)(const StepStats&);
+	};
+	static const Metric METRICS[] =
+	{
+		{ "broad ms",		1000.0, [](const StepStats& s) { return s.time.broadPhase; } },
+		{ "narrow ms",		1000.0, [](const StepStats& s) { return s.time.narrowPhase; } },
+		{ "response ms",	1000.0, [](const StepStats& s) { return s.time.response; } },
+		{ "gravity ms",		1000.0, [](const StepStats& s) { return s.time.gravity; } },
+		{ "integrate ms",	1000.0, [](const StepStats& s) { return s.time.integration; } },
+		{ "total ms",		1000.0, [](const StepStats& s) { return s.time.total(); } },
+		{ "candidates",		1.0,	[](const StepStats& s) { return static_cast<double>(s.candidatePairs); } },
+		{ "contacts",		1.0,	[](const StepStats& s) { return static_cast<double>(s.contacts); } },
+		{ "coalescences",	1.0,	[](const StepStats& s) { return static_cast<double>(s.coalescences); } },
+		{ "batches",		1.0,	[](const StepStats& s) { return static_cast<double>(s.contactBatches); } },
+		{ "migrations",		1.0,	[](const StepStats& s) { return static_cast<double>(s.cellMigrations); } },
+		{ "grav targets",	1.0,	[](const StepStats& s) { return static_cast<double>(s.gravityTargets); } },
+	};
+
+	out << "last " << m_history.size() << " steps\n";
+	out << std::left << std::setw(14) << "" << std::right
+		<< std::setw(12) << "mean" << std::setw(12) << "min" << std::setw(12) << "max" << "\n";
+
+	std::vector<double> values(m_history.size());
+	for (const Metric& metric : METRICS)
+	{
+		double sum = 0.0;
+		for (int i = 0; i < historySize(); i++)
+		{
+			values[i] = metric.get(history(i)) * metric.scale;
+			sum += values[i];
+		}
+		auto range = std::minmax_element(values.begin(), values.end());
+		out << std::left << std::setw(14) << metric.name << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(12) << sum / values.size()
+			<< std::setw(12) << *range.first
+			<< std::setw(12) << *range.second << "\n";
+	}
+	out.unsetf(std::ios::fixed);
+
+	for (int i = 0; i < historySize(); i++)
+		values[i] = history(i).time.total() * 1000.0;
+	out << "total step time\n";
+	_dumpHistogram(out, values, "ms");
+}
+
+void Instrumentation::_dumpHistogram(std::ostream& out, const std::vector<double>& values, const char* unit) const
+{
+	auto range = std::minmax_element(values.begin(), values.end());
+	double lo = *range.first, hi = *range.second;
+	double width = (hi - lo) / INSTRUMENTATION_BUCKETS;
+
+	int buckets[INSTRUMENTATION_BUCKETS] = {};
+	for (double v : values)
+	{
+		int b = width > 0.0 ? static_cast<int>((v - lo) / width) : 0;
+		buckets[std::min(b, INSTRUMENTATION_BUCKETS - 1)]++;
+	}
+
+	int peak = *std::max_element(buckets, buckets + INSTRUMENTATION_BUCKETS);
+	for (int b = 0; b < INSTRUMENTATION_BUCKETS; b++)
+	{
+		// Equal values all land in the first bucket, skip the empty rest
+		if (width <= 0.0 && b > 0)
+			break;
+
+		int bar = peak > 0 ? buckets[b] * INSTRUMENTATION_BAR_WIDTH / peak : 0;
+		out << std::fixed << std::setprecision(3) << std::setw(10) << lo + width * b << " " << unit << " |"
+			<< std::string(bar, '#') << std::string(INSTRUMENTATION_BAR_WIDTH - bar, ' ')
+			<< "| " << buckets[b] << "\n";
+	}
+	out.unsetf(std::ios::fixed);
+}
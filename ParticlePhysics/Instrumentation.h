@@ -0,0 +1,148 @@
+/*
+* Lightweight per step timers and counters for Universe::update.
+* Build with PARTICLES_INSTRUMENTATION 0 to compile every timer and counter
+* in the hot path away, the query API then reports zeros.
+* @author Dominick Dimpfel
+* @date 02/16/2024
+*/
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+#ifndef PARTICLES_INSTRUMENTATION
+#define PARTICLES_INSTRUMENTATION	1
+#endif
+
+#define INSTRUMENTATION_HISTORY		240 // Steps kept for the rolling histogram
+#define INSTRUMENTATION_BUCKETS		12
+#define INSTRUMENTATION_BAR_WIDTH	40
+
+/*
+* Wall time in seconds spent in each phase of one Universe::update.
+* Broad phase covers grid queries and grid maintenance, narrow phase the
+* pair tests including response. Response is the part of the narrow phase
+* spent in impulses and merges.
+*/
+struct StepTimings
+{
+	double broadPhase = 0.0;
+	double narrowPhase = 0.0;
+	double response = 0.0;
+	double gravity = 0.0;
+	double integration = 0.0;
+
+	double total() const	{ return broadPhase + narrowPhase + gravity + integration; }
+};
+
+/*
+* Everything recorded for one step
+*/
+struct StepStats
+{
+	StepTimings time;
+	long long candidatePairs = 0;	// unique pairs from the broad phase
+	long long contacts = 0;			// pairs found overlapping
+	long long coalescences = 0;
+	long long contactBatches = 0;	// independent contact batches, one is solved at a time
+	long long cellMigrations = 0;	// clients whose cell range changed
+	long long gravityTargets = 0;	// bodies given a gravity evaluation, summed over sub-steps
+};
+
+/*
+* Adds the time from construction to destruction to target
+*/
+class ScopedTimer
+{
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	double& m_target;
+	Clock::time_point m_start;
+
+public:
+	explicit ScopedTimer(double& target) : m_target(target), m_start(Clock::now()) {}
+	~ScopedTimer()		{ m_target += std::chrono::duration<double>(Clock::now() - m_start).count(); }
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator = (const ScopedTimer&) = delete;
+};
+
+#define INSTRUMENTATION_CONCAT_(a, b)	a##b
+#define INSTRUMENTATION_CONCAT(a, b)	INSTRUMENTATION_CONCAT_(a, b)
+
+#if PARTICLES_INSTRUMENTATION
+#define PARTICLES_TIME_SCOPE(target)	ScopedTimer INSTRUMENTATION_CONCAT(scopedTimer, __LINE__)(target)
+#define PARTICLES_COUNT(counter, n)		((counter) += (n))
+#else
+// Unevaluated so arguments still count as used but no code is generated
+#define PARTICLES_TIME_SCOPE(target)	((void)sizeof(target))
+#define PARTICLES_COUNT(counter, n)		((void)sizeof((counter) += (n)))
+#endif
+
+/*
+* Stats of the step in progress plus a ring of the last
+* INSTRUMENTATION_HISTORY finished steps
+*/
+class Instrumentation
+{
+private:
+	StepStats m_current;
+	std::vector<StepStats> m_history;
+	int m_head = 0;		// slot the next finished step goes to
+
+public:
+	Instrumentation() = default;
+	~Instrumentation() = default;
+
+	/*
+	* Reset the current step, call before any timer or counter of a step
+	*/
+	void beginStep()						{ m_current = StepStats(); }
+
+	/*
+	* Push the current step into the history
+	*/
+	void endStep();
+
+	/*
+	* Stats of the step in progress, timers and counters write here
+	*/
+	StepStats& current()					{ return m_current; }
+
+	/*
+	* Stats of the most recently finished step
+	*/
+	const StepStats& last() const;
+
+	/*
+	* Mean of every field over the steps in the history
+	*/
+	StepStats average() const;
+
+	/*
+	* Number of finished steps in the history
+	*/
+	int historySize() const					{ return static_cast<int>(m_history.size()); }
+
+	/*
+	* Finished step i of the history, 0 is the oldest
+	*/
+	const StepStats& history(int i) const;
+
+	void clear();
+
+	/*
+	* Write mean, min and max of every timer and counter over the history
+	* followed by a histogram of total step time
+	*/
+	void dump(std::ostream& out) const;
+
+	static bool enabled()					{ return PARTICLES_INSTRUMENTATION != 0; }
+
+private:
+	void _dumpHistogram(std::ostream& out, const std::vector<double>& values, const char* unit) const;
+};
+
+#endif // !INSTRUMENTATION_H
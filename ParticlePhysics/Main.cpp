@@ -1,9 +1,16 @@
 #include "Main.h"
 #include <SFML/Graphics.hpp>
+#include <thread>
 #include "Universe.h"
+#include "Scenes.h"
+#include "ParticleBatch.h"
+#include "SimulationThread.h"
 using namespace std;
 using namespace sf;
 
+#define PIPELINED		true // Step physics on its own thread, see SimulationThread
+#define SIMULATION_RATE	60 // Steps per second of the pipelined simulation
+
 
 void wrapAround(int width, int height, Particle& p)
 {
@@ -18,68 +25,9 @@ void wrapAround(int width, int height, Particle& p)
 }
 
 
-void setupCircularOrbits(Universe& u, const Vec2f& CENTER, float CENTER_MASS, float CENTER_RADIUS, float MAX_RADIUS) {
-	Particle& sun = u.createParticle(CENTER, Vec2f(), CENTER_MASS, CENTER_RADIUS);
-	sun.setColor(253, 184, 19);
-
-	CircleShape csCenter = CircleShape(sun.getRadius());
-	csCenter.setFillColor(sun.getColor());
-
-	for (int i = 0; i < UNIVERSE_CAPACITY - 1; i++) 
-	{
-		auto distance = static_cast<float>(rand() % static_cast<int>(MAX_RADIUS)) + sun.getRadius() * 1.2f;
-		float angle = static_cast<float>(rand()) / RAND_MAX * 2 * PI;
-		Vec2f pos = Vec2f(distance * cos(angle), distance * sin(angle)) + CENTER;
-
-		float speed = sqrt(G_CONSTANT * CENTER_MASS / distance);
-		Vec2f vel = Vec2f(-speed * sin(angle), speed * cos(angle));
-
-		Particle& p = u.createParticle(pos, vel);
-		p.setMass(rand() % 2 + .5f);
-		p.setRadius(p.getMass() * RADIUS_TO_MASS_RATIO);
-		p.setColor(rand() % 255, rand() % 255, rand() % 255);
-
-		CircleShape csi;
-		csi.setRadius(p.getRadius());
-		csi.setFillColor(p.getColor());
-		csi.setPosition(p.getPos().x - p.getRadius(), p.getPos().y - p.getRadius());
-	}
-}
-
-void setupDiskOfParticles(Universe& u, const Vec2f& CENTER, float MAX_RADIUS) {
-	for (int i = 0; i < UNIVERSE_CAPACITY; i++) 
-	{
-		auto distance = static_cast<float>(rand() % static_cast<int>(MAX_RADIUS) + 1);
-		float angle = static_cast<float>(rand()) / RAND_MAX * 2 * PI;
-		Vec2f pos = Vec2f(distance * cos(angle), distance * sin(angle)) + CENTER;
-
-		float speed = sqrt(G_CONSTANT * PARTICLE_MASS / distance);
-		Vec2f vel = Vec2f(-speed * sin(angle), speed * cos(angle));
-
-		Particle& p = u.createParticle(pos, vel);
-		p.setColor(rand() % 255, rand() % 255, rand() % 255);
-
-		CircleShape csi;
-		csi.setRadius(p.getRadius());
-		csi.setFillColor(p.getColor());
-		csi.setPosition(p.getPos().x - p.getRadius(), p.getPos().y - p.getRadius());
-	}
-}
-
-void setupRandomDispersion(Universe& u, int WIDTH, int HEIGHT) {
-	for (int i = 0; i < UNIVERSE_CAPACITY; i++) 
-	{
-		Vec2f pos = Vec2f(rand() % WIDTH, rand() % HEIGHT);
-
-		Particle& p = u.createParticle(pos, Vec2f());
-		p.setColor(rand() % 255, rand() % 255, rand() % 255);
-		p.setMass(10.f);
-
-		CircleShape csi;
-		csi.setRadius(p.getRadius());
-		csi.setFillColor(p.getColor());
-		csi.setPosition(p.getPos().x - p.getRadius(), p.getPos().y - p.getRadius());
-	}
+Color toSfColor(const ParticleColor& c)
+{
+	return Color(c.r, c.g, c.b, c.a);
 }
 
 void drawGrid(SpatialHashGrid grid, RenderWindow& window, Color color)
@@ -101,10 +49,20 @@ void drawGrid(SpatialHashGrid grid, RenderWindow& window, Color color)
 	}
 }
 
-
-#define	WIDTH		1200
-#define HEIGHT		675
-#define DELTA_TIME	100.f
+template <typename Columns>
+void drawParticles(const Columns& columns, const ParticleBatch& batch, VertexArray& vertices, RenderWindow& window)
+{
+	// POINTS is one vertex per particle, the other shapes are triangle lists
+	vertices.setPrimitiveType(batch.getShape() == BatchShape::POINTS ? Points : Triangles);
+	vertices.resize(batch.vertexCount(columns));
+	if (vertices.getVertexCount() == 0)
+		return;
+	batch.fill(columns, &vertices[0], [](float x, float y, const ParticleColor& c)
+	{
+		return Vertex(Vector2f(x, y), toSfColor(c));
+	});
+	window.draw(vertices);
+}
 
 int main()
 {
@@ -120,7 +78,10 @@ int main()
 
 
 	Universe u = Universe();
-	CircleShape shape;
+	u.setThreadCount(static_cast<int>(std::thread::hardware_concurrency()));
+	// Every particle goes into one vertex array drawn with a single call
+	ParticleBatch batch;
+	VertexArray vertices;
 
 
 	//Particle& p1 = u.createParticle(Vec2f(500, 225), Vec2f(0.f, 0), 50, 5);
@@ -132,10 +93,18 @@ int main()
 	//Particle& p4 = u.createParticle(Vec2f(500, 425), Vec2f(0.f, 0), 50, 5);
 	//p4.setColor(rand() % 255, rand() % 255, rand() % 255);
 
+	// Disk moves nearly every particle each step, cheaper to rebuild grid
+	u.setGridMode(GridMode::REBUILD);
+
 	//setupCircularOrbits(u, CENTER, 3'000.f, 50.f, 300.f);
 	setupDiskOfParticles(u, CENTER, 250.f);
 	//setupRandomDispersion(u, WIDTH, HEIGHT);
 
+	// The window draws the latest published frame while the simulation
+	// steps, neither waits for the other
+	SimulationThread simulation(u);
+	if (PIPELINED)
+		simulation.start(DELTA_TIME, SIMULATION_RATE);
 
 
 	while (window.isOpen())
@@ -155,24 +124,22 @@ int main()
 		//drawGrid(u.getCollisionGrid(), window, Color::Green);
 		//drawGrid(u.getGravityGrid(), window, Color::Blue);
 
-		for (auto& kv :u.getParticles())
+		if (PIPELINED)
 		{
-			const Particle& p = kv.second;
-			//wrapAround(WIDTH, HEIGHT, p);
-			shape.setFillColor(p.getColor());
-			shape.setPosition(p.getPos().x - p.getRadius(), p.getPos().y - p.getRadius());
-			if (shape.getRadius() != p.getRadius())
-				shape.setRadius(static_cast<int>(p.getRadius()));
-		
-			window.draw(shape);
+			simulation.acquire();
+			drawParticles(simulation.frame(), batch, vertices, window);
 		}
+		else
+			drawParticles(u.getStore(), batch, vertices, window);
 
 
 		window.display();
 
 
-		u.update(DELTA_TIME);
+		if (!PIPELINED)
+			u.update(DELTA_TIME);
 
 	}
+	simulation.stop();
 	return 0;
 }
@@ -1,94 +1,75 @@
 /*
 * Simple 2D particle class to implement physics.
-* Has no physical representation.
+* Has no physical representation. A particle is a view of one id in a
+* ParticleStore, it holds no state of its own and is cheap to copy. The
+* id's generation is kept so a view of a removed particle stays invalid
+* after its id is reused.
 * @author Dominick Dimpfel
 * @date 01/22/2024
 */
 #ifndef PARTICLE_H
 #define PARTICLE_H
+#include <cstdint>
 #include "Vec2f.h"
-#include <SFML/Graphics.hpp>
-
-#define PARTICLE_MASS			1.f
-#define RADIUS_TO_MASS_RATIO	1.f
+#include "ParticleStore.h"
+#include "ParticleColor.h"
 
 class Particle
 {
 private:
+	ParticleStore* m_store;
 	int m_id;
-	bool m_active;
-	float m_radius;
-
-	Vec2f m_pos;
-	Vec2f m_vel;
-	Vec2f m_acc;
-
-	float m_mass;
-	float m_invMass;
-
-	Vec2f m_forces;
+	std::uint32_t m_generation;
 
-	sf::Color m_c{};
+	int _slot() const						{ return m_store->slotOf(m_id); }
 
 public:
-	Particle() {}
-	Particle(int i)
-	{
-		m_id = i;
-		m_active = false;
-		m_radius = RADIUS_TO_MASS_RATIO * PARTICLE_MASS;
-
-		m_pos = Vec2f();
-		m_vel = Vec2f();
-		m_acc = Vec2f();
-
-		m_mass = PARTICLE_MASS;
-		m_invMass = 1.f / PARTICLE_MASS;
-
-		m_forces = Vec2f();
-	}
+	Particle() : m_store(nullptr), m_id(-1), m_generation(0) {}
+	Particle(ParticleStore* store, int id) : m_store(store), m_id(id), m_generation(store->generationOf(id)) {}
 	~Particle() = default;
 
-	void update(float dt)
+	/*
+	* @return false once the particle has been removed from its universe,
+	* even if a new particle took over its id
+	*/
+	bool isValid() const
 	{
-		m_acc = m_forces * m_invMass;
-		m_vel += m_acc * dt;
-		m_pos += m_vel * dt;
-		clearForces();
+		return m_store && m_store->contains(m_id) && m_store->generationOf(m_id) == m_generation;
 	}
 
-	const sf::Color& getColor() const		{ return m_c; }
-	void setColor(int r, int g, int b)		{ m_c = sf::Color(r, g, b); }
-	void setColor(sf::Color c)				{ m_c = c; }
+	const ParticleColor& getColor() const	{ return m_store->color[_slot()]; }
+	void setColor(int r, int g, int b)		{ m_store->color[_slot()] = ParticleColor(r, g, b); }
+	void setColor(const ParticleColor& c)	{ m_store->color[_slot()] = c; }
 
-	void addForce(const Vec2f& f)			{ m_forces += f; }
-	const Vec2f& getForces()				{ return m_forces; }
-	void clearForces()						{ m_forces.zero(); }
+	void addForce(const Vec2f& f)
+	{
+		int s = _slot();
+		m_store->fx[s] += f.x;
+		m_store->fy[s] += f.y;
+	}
+	Vec2f getForces() const					{ int s = _slot(); return Vec2f(m_store->fx[s], m_store->fy[s]); }
+	void clearForces()						{ int s = _slot(); m_store->fx[s] = 0.f; m_store->fy[s] = 0.f; }
 
-	const float getRadius() const			{ return m_radius; }
-	void setRadius(float radius)			{ m_radius = radius; }
+	float getRadius() const					{ return m_store->radius[_slot()]; }
+	void setRadius(float radius)			{ m_store->radius[_slot()] = radius; }
 
-	const Vec2f& getPos() const				{ return m_pos; }
-	void setPos(const Vec2f& pos)			{ m_pos = pos; }
+	Vec2f getPos() const					{ int s = _slot(); return Vec2f(m_store->x[s], m_store->y[s]); }
+	void setPos(const Vec2f& pos)			{ int s = _slot(); m_store->x[s] = pos.x; m_store->y[s] = pos.y; }
 
-	const Vec2f& getVel() const				{ return m_vel; }
-	void setVel(const Vec2f& vel)			{ m_vel = vel; }
+	Vec2f getVel() const					{ int s = _slot(); return Vec2f(m_store->vx[s], m_store->vy[s]); }
+	void setVel(const Vec2f& vel)			{ int s = _slot(); m_store->vx[s] = vel.x; m_store->vy[s] = vel.y; }
 
-	const Vec2f& getAcc() const				{ return m_acc; }
-	void setAcc(const Vec2f& acc)			{ m_acc = acc; }
+	Vec2f getAcc() const					{ int s = _slot(); return Vec2f(m_store->ax[s], m_store->ay[s]); }
+	void setAcc(const Vec2f& acc)			{ int s = _slot(); m_store->ax[s] = acc.x; m_store->ay[s] = acc.y; }
 
-	const float getMass() const				{ return m_mass; }
-	const float getInvMass() const			{ return m_invMass; }
-	void setMass(float mass) 
-	{ 
-		m_mass = mass; 
-		m_invMass = m_mass != 0.0f ? 1 / m_mass : 0.0f;
-	}
+	float getMass() const					{ return m_store->mass[_slot()]; }
+	float getInvMass() const				{ return m_store->invMass[_slot()]; }
+	void setMass(float mass)				{ m_store->setMass(_slot(), mass); }
 
-	const int getID() const					{ return m_id; }
+	int getID() const						{ return m_id; }
 
-	bool isActive() const					{ return m_active; }
-	void setActive(bool val)				{ m_active = val; }
+	bool isActive() const					{ return m_store->active[_slot()] != 0; }
+	void setActive(bool val)				{ m_store->active[_slot()] = val; }
 
 	bool operator < (const Particle& rs) const
 	{
@@ -96,5 +77,35 @@ public:
 	}
 };
 
-#endif // !PARTICLE_H
+/*
+* Iterable range of particle views over every slot of a store
+*/
+class ParticleRange
+{
+private:
+	ParticleStore* m_store;
+
+public:
+	class Iterator
+	{
+	private:
+		ParticleStore* m_store;
+		int m_slot;
 
+	public:
+		Iterator(ParticleStore* store, int slot) : m_store(store), m_slot(slot) {}
+
+		Particle operator*() const			{ return Particle(m_store, m_store->id[m_slot]); }
+		Iterator& operator++()				{ m_slot++; return *this; }
+		bool operator != (const Iterator& rs) const { return m_slot != rs.m_slot; }
+	};
+
+	ParticleRange(ParticleStore* store) : m_store(store) {}
+
+	Iterator begin() const					{ return Iterator(m_store, 0); }
+	Iterator end() const					{ return Iterator(m_store, m_store->size()); }
+	size_t size() const						{ return static_cast<size_t>(m_store->size()); }
+	bool empty() const						{ return m_store->empty(); }
+};
+
+#endif // !PARTICLE_H
@@ -0,0 +1,62 @@
+/*
+* Single pass vertex batch of every particle
+* @author Dominick Dimpfel
+* @date 03/03/2024
+*/
+
+#include "ParticleBatch.h"
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+static const double PI = 3.14159265358979323846;
+
+ParticleBatch::ParticleBatch(BatchShape shape, int segments)
+{
+	m_shape = shape;
+	setSegments(segments);
+}
+
+void ParticleBatch::setSegments(int segments)
+{
+	m_segments = std::max(BATCH_MIN_SEGMENTS, std::min(segments, BATCH_MAX_SEGMENTS));
+	m_cos.resize(m_segments + 1);
+	m_sin.resize(m_segments + 1);
+	for (int k = 0; k <= m_segments; k++)
+	{
+		// Last corner is the first again so circles close exactly
+		double angle = 2.0 * PI * (k % m_segments) / m_segments;
+		m_cos[k] = static_cast<float>(std::cos(angle));
+		m_sin[k] = static_cast<float>(std::sin(angle));
+	}
+}
+
+int ParticleBatch::verticesPerParticle() const
+{
+	switch (m_shape)
+	{
+	case BatchShape::POINTS:	return 1;
+	case BatchShape::QUADS:		return 6;
+	default:					return 3 * m_segments;
+	}
+}
+
+const char* ParticleBatch::shapeName(BatchShape shape)
+{
+	switch (shape)
+	{
+	case BatchShape::POINTS:	return "points";
+	case BatchShape::QUADS:		return "quads";
+	default:					return "circles";
+	}
+}
+
+bool ParticleBatch::parseShape(const std::string& name, BatchShape& shape)
+{
+	if (name == "points")		shape = BatchShape::POINTS;
+	else if (name == "quads")	shape = BatchShape::QUADS;
+	else if (name == "circles")	shape = BatchShape::CIRCLES;
+	else						return false;
+	return true;
+}
@@ -0,0 +1,143 @@
+/*
+* Builds the vertices of every particle in one pass over the store so a
+* frame is drawn with a single draw call. Kept free of SFML, fill takes a
+* function making one vertex so the same pass writes SFML vertices in the
+* app and BatchVertex buffers in headless tools.
+* @author Dominick Dimpfel
+* @date 03/03/2024
+*/
+#ifndef PARTICLEBATCH_H
+#define PARTICLEBATCH_H
+#include <string>
+#include <vector>
+#include "ParticleColor.h"
+#include "ParticleStore.h"
+
+#define BATCH_CIRCLE_SEGMENTS	12
+#define BATCH_MIN_SEGMENTS		3
+#define BATCH_MAX_SEGMENTS		64
+
+/*
+* How a particle is drawn. POINTS is one vertex per particle and ignores
+* the radius, QUADS and CIRCLES are triangle lists covering the radius.
+*/
+enum class BatchShape
+{
+	POINTS,
+	QUADS,
+	CIRCLES
+};
+
+struct BatchVertex
+{
+	float x, y;
+	ParticleColor color;
+};
+
+class ParticleBatch
+{
+private:
+	BatchShape m_shape;
+	int m_segments;
+	// Unit circle corners, one more than segments so corner k + 1 exists
+	std::vector<float> m_cos, m_sin;
+
+public:
+	ParticleBatch(BatchShape shape = BatchShape::CIRCLES, int segments = BATCH_CIRCLE_SEGMENTS);
+	~ParticleBatch() = default;
+
+	void setShape(BatchShape shape)		{ m_shape = shape; }
+	BatchShape getShape() const			{ return m_shape; }
+
+	/*
+	* Triangles per circle, clamped to BATCH_MIN_SEGMENTS to BATCH_MAX_SEGMENTS
+	*/
+	void setSegments(int segments);
+	int getSegments() const				{ return m_segments; }
+
+	int verticesPerParticle() const;
+
+	/*
+	* Columns is a ParticleStore or anything with the same x, y, radius
+	* and color columns and size(), such as a RenderFrame
+	*/
+	template <typename Columns>
+	int vertexCount(const Columns& ps) const		{ return ps.size() * verticesPerParticle(); }
+
+	/*
+	* Write vertexCount(ps) vertices to out, particle i owns the
+	* verticesPerParticle() vertices starting at i * verticesPerParticle().
+	* make(x, y, color) returns one Vertex.
+	*/
+	template <typename Columns, typename Vertex, typename Make>
+	void fill(const Columns& ps, Vertex* out, Make make) const;
+
+	/*
+	* fill into a CPU buffer, resized to vertexCount(ps)
+	*/
+	template <typename Columns>
+	void fill(const Columns& ps, std::vector<BatchVertex>& out) const;
+
+	static const char* shapeName(BatchShape shape);
+	static bool parseShape(const std::string& name, BatchShape& shape);
+};
+
+template <typename Columns, typename Vertex, typename Make>
+void ParticleBatch::fill(const Columns& ps, Vertex* out, Make make) const
+{
+	int n = ps.size();
+	const float* x = ps.x.data();
+	const float* y = ps.y.data();
+	const float* radius = ps.radius.data();
+	const ParticleColor* color = ps.color.data();
+
+	switch (m_shape)
+	{
+	case BatchShape::POINTS:
+		for (int i = 0; i < n; i++)
+			*out++ = make(x[i], y[i], color[i]);
+		break;
+	case BatchShape::QUADS:
+		for (int i = 0; i < n; i++)
+		{
+			float r = radius[i];
+			Vertex a = make(x[i] - r, y[i] - r, color[i]);
+			Vertex c = make(x[i] + r, y[i] + r, color[i]);
+			*out++ = a;
+			*out++ = make(x[i] + r, y[i] - r, color[i]);
+			*out++ = c;
+			*out++ = a;
+			*out++ = c;
+			*out++ = make(x[i] - r, y[i] + r, color[i]);
+		}
+		break;
+	case BatchShape::CIRCLES:
+		for (int i = 0; i < n; i++)
+		{
+			float r = radius[i];
+			Vertex center = make(x[i], y[i], color[i]);
+			Vertex corner = make(x[i] + r * m_cos[0], y[i] + r * m_sin[0], color[i]);
+			for (int k = 0; k < m_segments; k++)
+			{
+				Vertex next = make(x[i] + r * m_cos[k + 1], y[i] + r * m_sin[k + 1], color[i]);
+				*out++ = center;
+				*out++ = corner;
+				*out++ = next;
+				corner = next;
+			}
+		}
+		break;
+	}
+}
+
+template <typename Columns>
+void ParticleBatch::fill(const Columns& ps, std::vector<BatchVertex>& out) const
+{
+	out.resize(vertexCount(ps));
+	fill(ps, out.data(), [](float x, float y, const ParticleColor& color)
+	{
+		return BatchVertex{ x, y, color };
+	});
+}
+
+#endif // !PARTICLEBATCH_H
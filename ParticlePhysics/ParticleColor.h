@@ -0,0 +1,22 @@
+/*
+* RGBA color of a particle, kept free of any graphics library so the
+* simulation core builds without SFML.
+* @author Dominick Dimpfel
+* @date 02/14/2024
+*/
+#ifndef PARTICLECOLOR_H
+#define PARTICLECOLOR_H
+#include <cstdint>
+
+struct ParticleColor
+{
+	std::uint8_t r, g, b, a;
+
+	/* Opaque black */
+	ParticleColor() : r(0), g(0), b(0), a(255) {}
+	ParticleColor(int _r, int _g, int _b, int _a = 255) :
+		r(static_cast<std::uint8_t>(_r)), g(static_cast<std::uint8_t>(_g)),
+		b(static_cast<std::uint8_t>(_b)), a(static_cast<std::uint8_t>(_a)) {}
+};
+
+#endif // !PARTICLECOLOR_H
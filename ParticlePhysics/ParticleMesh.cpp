@@ -0,0 +1,292 @@
+/*
+* Particle-mesh gravity with FFT convolution on a zero padded mesh
+* @author Dominick Dimpfel
+* @date 02/24/2024
+*/
+
+#include "ParticleMesh.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include "ThreadPool.h"
+
+// The field at cell t is E(t) = sum_s m(s) * W(t - s) with
+// W(d) = -G * d / |d|^3, a linear convolution. Padding both axes to twice
+// the mesh size makes the circular convolution of the FFT equal to it for
+// every offset between two mesh cells. Wx and Wy are packed into one
+// complex kernel, since mass is real the inverse transform of the product
+// is Ex + i * Ey and one transform yields both components.
+
+static const double PI = 3.14159265358979323846;
+
+static int nextPowerOfTwo(int n)
+{
+	int p = 1;
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+ParticleMesh::ParticleMesh(int meshSize, float g)
+{
+	m_g = g;
+	setMeshSize(meshSize);
+}
+
+void ParticleMesh::setMeshSize(int cells)
+{
+	m_meshSize = nextPowerOfTwo(std::max(PM_MIN_MESH_SIZE, std::min(cells, PM_MAX_MESH_SIZE)));
+
+	// Refit on the next computeForces
+	m_nx = 0;
+	m_ny = 0;
+}
+
+float ParticleMesh::shortRangeFactor(float r, float split)
+{
+	if (split <= 0.f)
+		return 0.f;
+	float u = r / (2.f * split);
+	return std::erfc(u) + 2.f * u / std::sqrt(static_cast<float>(PI)) * std::exp(-u * u);
+}
+
+void ParticleMesh::computeForces(ThreadPool& pool, const float* x, const float* y, const float* mass, int count,
+	float* fx, float* fy)
+{
+	if (count == 0)
+		return;
+
+	_place(x, y, count);
+	m_activeSplit = m_splitRadius > 0.f
+		? std::max(m_splitRadius, PM_MIN_SPLIT_CELLS * static_cast<float>(m_cell))
+		: 0.f;
+	if (m_kernelCell != m_cell || m_kernelSplit != m_activeSplit)
+		_buildKernel(pool);
+
+	int px = 2 * m_nx;
+	int py = 2 * m_ny;
+	m_grid.assign(static_cast<size_t>(px) * py, Complex{ 0.0, 0.0 });
+
+	// Cloud in cell deposit around cell centers, _place keeps every body a
+	// cell away from the edge so all four cells exist
+	for (int i = 0; i < count; i++)
+	{
+		double u = (x[i] - m_originX) / m_cell - 0.5;
+		double v = (y[i] - m_originY) / m_cell - 0.5;
+		int cx = static_cast<int>(std::floor(u));
+		int cy = static_cast<int>(std::floor(v));
+		double tx = u - cx, ty = v - cy;
+		Complex* cell = &m_grid[static_cast<size_t>(cy) * px + cx];
+		cell[0].re += mass[i] * (1.0 - tx) * (1.0 - ty);
+		cell[1].re += mass[i] * tx * (1.0 - ty);
+		cell[px].re += mass[i] * (1.0 - tx) * ty;
+		cell[px + 1].re += mass[i] * tx * ty;
+	}
+
+	_transform(pool, m_grid, m_ny, false);
+	pool.parallelFor(0, static_cast<int>(m_grid.size()), [&](int, int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			Complex a = m_grid[i];
+			const Complex& b = m_kernel[i];
+			m_grid[i] = Complex{ a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re };
+		}
+	});
+	_transform(pool, m_grid, m_ny, true);
+
+	// Interpolate with the deposit weights, which also cancels self force
+	// since the kernel is antisymmetric
+	double scale = 1.0 / (static_cast<double>(px) * py);
+	pool.parallelFor(0, count, [&](int, int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			double u = (x[i] - m_originX) / m_cell - 0.5;
+			double v = (y[i] - m_originY) / m_cell - 0.5;
+			int cx = static_cast<int>(std::floor(u));
+			int cy = static_cast<int>(std::floor(v));
+			double tx = u - cx, ty = v - cy;
+			const Complex* cell = &m_grid[static_cast<size_t>(cy) * px + cx];
+			double w0 = (1.0 - tx) * (1.0 - ty), w1 = tx * (1.0 - ty), w2 = (1.0 - tx) * ty, w3 = tx * ty;
+			double ex = w0 * cell[0].re + w1 * cell[1].re + w2 * cell[px].re + w3 * cell[px + 1].re;
+			double ey = w0 * cell[0].im + w1 * cell[1].im + w2 * cell[px].im + w3 * cell[px + 1].im;
+			fx[i] += static_cast<float>(mass[i] * ex * scale);
+			fy[i] += static_cast<float>(mass[i] * ey * scale);
+		}
+	});
+}
+
+void ParticleMesh::_place(const float* x, const float* y, int count)
+{
+	double minX = x[0], maxX = x[0], minY = y[0], maxY = y[0];
+	for (int i = 1; i < count; i++)
+	{
+		minX = std::min(minX, static_cast<double>(x[i]));
+		maxX = std::max(maxX, static_cast<double>(x[i]));
+		minY = std::min(minY, static_cast<double>(y[i]));
+		maxY = std::max(maxY, static_cast<double>(y[i]));
+	}
+	double span = std::max(maxX - minX, maxY - minY) * PM_MESH_SLACK;
+
+	if (m_nx > 0)
+	{
+		bool inside = minX >= m_originX + m_cell && maxX <= m_originX + (m_nx - 1) * m_cell &&
+			minY >= m_originY + m_cell && maxY <= m_originY + (m_ny - 1) * m_cell;
+		bool filled = span * 2.0 >= (m_meshSize - 2) * m_cell;
+		if (inside && filled)
+			return;
+	}
+
+	// Longer side gets the full mesh, the other the smallest power of two
+	// that holds the bodies plus a cell on either side
+	m_cell = std::max(span, 1.0e-3) / (m_meshSize - 2);
+	m_nx = std::min(m_meshSize, nextPowerOfTwo(static_cast<int>(std::ceil((maxX - minX) * PM_MESH_SLACK / m_cell)) + 2));
+	m_ny = std::min(m_meshSize, nextPowerOfTwo(static_cast<int>(std::ceil((maxY - minY) * PM_MESH_SLACK / m_cell)) + 2));
+	m_nx = std::max(m_nx, 4);
+	m_ny = std::max(m_ny, 4);
+	m_originX = (minX + maxX) * 0.5 - m_nx * m_cell * 0.5;
+	m_originY = (minY + maxY) * 0.5 - m_ny * m_cell * 0.5;
+
+	_twiddles(2 * m_nx, m_twiddleX);
+	_twiddles(2 * m_ny, m_twiddleY);
+	m_kernelCell = 0.0;
+}
+
+void ParticleMesh::_buildKernel(ThreadPool& pool)
+{
+	int px = 2 * m_nx;
+	int py = 2 * m_ny;
+	m_kernel.assign(static_cast<size_t>(px) * py, Complex{ 0.0, 0.0 });
+
+	// Offsets past half the padded size wrap around to negative ones
+	double split = m_activeSplit / m_cell;
+	double scale = -m_g / (m_cell * m_cell);
+	pool.parallelFor(0, py, [&](int, int first, int last)
+	{
+		for (int j = first; j < last; j++)
+		{
+			int dy = j < m_ny ? j : j - py;
+			for (int i = 0; i < px; i++)
+			{
+				int dx = i < m_nx ? i : i - px;
+				if (dx == 0 && dy == 0) continue;
+
+				double r = std::sqrt(static_cast<double>(dx) * dx + static_cast<double>(dy) * dy);
+				double w = scale / (r * r * r);
+				if (split > 0.0)
+					w *= 1.0 - shortRangeFactor(static_cast<float>(r), static_cast<float>(split));
+				m_kernel[static_cast<size_t>(j) * px + i] = Complex{ w * dx, w * dy };
+			}
+		}
+	});
+	_transform(pool, m_kernel, py, false);
+
+	m_kernelCell = m_cell;
+	m_kernelSplit = m_activeSplit;
+}
+
+void ParticleMesh::_transform(ThreadPool& pool, std::vector<Complex>& data, int rows, bool inverse)
+{
+	int px = 2 * m_nx;
+	int py = 2 * m_ny;
+	m_columns.resize(pool.size());
+
+	auto transformRows = [&]()
+	{
+		pool.parallelFor(0, rows, [&](int, int first, int last)
+		{
+			for (int j = first; j < last; j++)
+				_fft(&data[static_cast<size_t>(j) * px], px, m_twiddleX, inverse);
+		});
+	};
+	auto transformColumns = [&]()
+	{
+		// Columns are gathered PM_COLUMN_BLOCK at a time so every row is
+		// read a cache line at a time instead of one value per line
+		int blocks = px / PM_COLUMN_BLOCK;
+		pool.parallelFor(0, blocks, [&](int t, int first, int last)
+		{
+			std::vector<Complex>& columns = m_columns[t];
+			columns.resize(static_cast<size_t>(py) * PM_COLUMN_BLOCK);
+			for (int block = first; block < last; block++)
+			{
+				int i0 = block * PM_COLUMN_BLOCK;
+				for (int j = 0; j < py; j++)
+				{
+					const Complex* row = &data[static_cast<size_t>(j) * px + i0];
+					for (int c = 0; c < PM_COLUMN_BLOCK; c++)
+						columns[static_cast<size_t>(c) * py + j] = row[c];
+				}
+				for (int c = 0; c < PM_COLUMN_BLOCK; c++)
+					_fft(&columns[static_cast<size_t>(c) * py], py, m_twiddleY, inverse);
+				for (int j = 0; j < py; j++)
+				{
+					Complex* row = &data[static_cast<size_t>(j) * px + i0];
+					for (int c = 0; c < PM_COLUMN_BLOCK; c++)
+						row[c] = columns[static_cast<size_t>(c) * py + j];
+				}
+			}
+		});
+	};
+
+	if (inverse)
+	{
+		transformColumns();
+		transformRows();
+	}
+	else
+	{
+		transformRows();
+		transformColumns();
+	}
+}
+
+void ParticleMesh::_fft(Complex* data, int n, const std::vector<Complex>& twiddles, bool inverse)
+{
+	// Bit reversal permutation
+	for (int i = 1, j = 0; i < n; i++)
+	{
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
+			std::swap(data[i], data[j]);
+	}
+
+	// Butterflies, inverse uses conjugate twiddles and is left unscaled
+	double sign = inverse ? -1.0 : 1.0;
+	for (int len = 2; len <= n; len <<= 1)
+	{
+		int half = len >> 1;
+		int step = n / len;
+		for (int i = 0; i < n; i += len)
+		{
+			for (int k = 0; k < half; k++)
+			{
+				const Complex& w = twiddles[k * step];
+				double wi = sign * w.im;
+				Complex& a = data[i + k];
+				Complex& b = data[i + k + half];
+				double tr = b.re * w.re - b.im * wi;
+				double ti = b.re * wi + b.im * w.re;
+				b.re = a.re - tr;
+				b.im = a.im - ti;
+				a.re += tr;
+				a.im += ti;
+			}
+		}
+	}
+}
+
+void ParticleMesh::_twiddles(int n, std::vector<Complex>& twiddles)
+{
+	twiddles.resize(n / 2);
+	for (int k = 0; k < n / 2; k++)
+	{
+		double angle = -2.0 * PI * k / n;
+		twiddles[k] = Complex{ std::cos(angle), std::sin(angle) };
+	}
+}
@@ -0,0 +1,129 @@
+/*
+* Particle-mesh gravity. Mass is deposited onto a uniform mesh with
+* cloud-in-cell weights, convolved with the force kernel through FFTs
+* and the mesh field is interpolated back to every body with the same
+* weights. The mesh is zero padded to twice its size so bodies do not
+* feel periodic images.
+* With a split radius the kernel only carries the long range part of
+* the force and shortRangeFactor gives the remainder for pairs closer
+* than getCutoff, which is the P3M scheme.
+* @author Dominick Dimpfel
+* @date 02/24/2024
+*/
+#ifndef PARTICLEMESH_H
+#define PARTICLEMESH_H
+#include <vector>
+#include "ThreadPool.h"
+
+#define PM_MESH_SIZE		256 // Cells along the longer side of the bodies' bounds
+#define PM_MIN_MESH_SIZE	8
+#define PM_MAX_MESH_SIZE	4096
+#define PM_MESH_SLACK		1.25f // Mesh span over body bounds so it is not refit every step
+#define PM_CUTOFF_SPLITS	5.f // Short range cutoff over split radius
+#define PM_MIN_SPLIT_CELLS	1.f // Smallest split radius in mesh cells
+#define PM_COLUMN_BLOCK		8 // Columns transformed together, divides every padded size
+
+class ParticleMesh
+{
+private:
+	// Complex values stored as interleaved re, im pairs
+	struct Complex
+	{
+		double re, im;
+	};
+
+	int m_meshSize;
+	float m_g;
+	float m_splitRadius = 0.f;		// requested, 0 for the full force
+	float m_activeSplit = 0.f;		// used by the last computeForces
+
+	// Mesh placement, kept while the bodies stay inside and fill it
+	double m_originX = 0.0, m_originY = 0.0;
+	double m_cell = 0.0;
+	int m_nx = 0, m_ny = 0;			// padded transforms are 2 * nx by 2 * ny
+
+	// Transform of the packed kernel Wx + i Wy, valid for m_kernelCell
+	// and m_kernelSplit on the current mesh
+	std::vector<Complex> m_kernel;
+	double m_kernelCell = 0.0;
+	float m_kernelSplit = -1.f;
+
+	std::vector<Complex> m_grid;
+	std::vector<Complex> m_twiddleX, m_twiddleY;
+	std::vector<std::vector<Complex>> m_columns;	// per thread column scratch
+
+public:
+	ParticleMesh(int meshSize, float g);
+	~ParticleMesh() = default;
+
+	/*
+	* Add the mesh force on every body to fx, fy. Deposit runs on the
+	* calling thread, transforms and interpolation are split across pool.
+	*/
+	void computeForces(ThreadPool& pool, const float* x, const float* y, const float* mass, int count,
+		float* fx, float* fy);
+
+	/*
+	* Cells along the longer side of the mesh, rounded up to a power of two
+	* and clamped to PM_MIN_MESH_SIZE to PM_MAX_MESH_SIZE
+	*/
+	void setMeshSize(int cells);
+	int getMeshSize() const				{ return m_meshSize; }
+
+	/*
+	* Gaussian split radius of P3M, 0 keeps the whole force on the mesh.
+	* The mesh cannot resolve a split under PM_MIN_SPLIT_CELLS cells so the
+	* split actually used can be larger, see getSplitRadius.
+	*/
+	void setSplitRadius(float radius)	{ m_splitRadius = radius; }
+
+	/*
+	* Split radius used by the last computeForces
+	*/
+	float getSplitRadius() const		{ return m_activeSplit; }
+
+	/*
+	* Distance beyond which the short range force is dropped
+	*/
+	float getCutoff() const				{ return m_activeSplit * PM_CUTOFF_SPLITS; }
+
+	float getCellSize() const			{ return static_cast<float>(m_cell); }
+
+	/*
+	* Fraction of the full force between two bodies at distance r that the
+	* mesh leaves out for split radius split, 1 at r = 0 falling to 0
+	*/
+	static float shortRangeFactor(float r, float split);
+
+private:
+	/*
+	* Fit the mesh around the bodies unless the current placement still
+	* holds them with a cell to spare and is not more than twice too big
+	*/
+	void _place(const float* x, const float* y, int count);
+
+	/*
+	* Fill and transform the kernel for the current mesh and split
+	*/
+	void _buildKernel(ThreadPool& pool);
+
+	/*
+	* 2D transform of a padded grid. Forward transforms rows first and only
+	* the first rows rows since the rest are zero, inverse transforms
+	* columns first and only the first rows rows afterwards since only
+	* those are read.
+	*/
+	void _transform(ThreadPool& pool, std::vector<Complex>& data, int rows, bool inverse);
+
+	/*
+	* In place radix 2 transform of n contiguous values
+	*/
+	static void _fft(Complex* data, int n, const std::vector<Complex>& twiddles, bool inverse);
+
+	/*
+	* e^(-2 pi i k / n) for k below n / 2
+	*/
+	static void _twiddles(int n, std::vector<Complex>& twiddles);
+};
+
+#endif // !PARTICLEMESH_H
@@ -0,0 +1,182 @@
+/*
+* Structure of arrays storage for every particle in a universe.
+* @author Dominick Dimpfel
+* @date 02/08/2024
+*/
+
+#include "ParticleStore.h"
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+int ParticleStore::add()
+{
+	int slot = size();
+
+	int particleId;
+	if (!m_freeIds.empty())
+	{
+		std::pop_heap(m_freeIds.begin(), m_freeIds.end(), std::greater<int>());
+		particleId = m_freeIds.back();
+		m_freeIds.pop_back();
+	}
+	else
+	{
+		particleId = idCount();
+		m_slotOf.push_back(-1);
+		m_generation.push_back(0);
+	}
+
+	x.push_back(0.f);
+	y.push_back(0.f);
+	vx.push_back(0.f);
+	vy.push_back(0.f);
+	fx.push_back(0.f);
+	fy.push_back(0.f);
+	ax.push_back(0.f);
+	ay.push_back(0.f);
+	mass.push_back(PARTICLE_MASS);
+	invMass.push_back(1.f / PARTICLE_MASS);
+	radius.push_back(RADIUS_TO_MASS_RATIO * PARTICLE_MASS);
+
+	id.push_back(particleId);
+	color.push_back(ParticleColor());
+	active.push_back(0);
+
+	m_slotOf[particleId] = slot;
+
+	return slot;
+}
+
+int ParticleStore::add(int count)
+{
+	int first = size();
+	int total = first + count;
+
+	x.resize(total, 0.f);
+	y.resize(total, 0.f);
+	vx.resize(total, 0.f);
+	vy.resize(total, 0.f);
+	fx.resize(total, 0.f);
+	fy.resize(total, 0.f);
+	ax.resize(total, 0.f);
+	ay.resize(total, 0.f);
+	mass.resize(total, PARTICLE_MASS);
+	invMass.resize(total, 1.f / PARTICLE_MASS);
+	radius.resize(total, RADIUS_TO_MASS_RATIO * PARTICLE_MASS);
+	color.resize(total, ParticleColor());
+	active.resize(total, 0);
+	id.resize(total);
+
+	// Free ids first, lowest first, then a fresh range
+	int slot = first;
+	for (; slot < total && !m_freeIds.empty(); slot++)
+	{
+		std::pop_heap(m_freeIds.begin(), m_freeIds.end(), std::greater<int>());
+		id[slot] = m_freeIds.back();
+		m_freeIds.pop_back();
+		m_slotOf[id[slot]] = slot;
+	}
+	int fresh = idCount();
+	m_slotOf.resize(fresh + total - slot);
+	m_generation.resize(fresh + total - slot, 0);
+	for (; slot < total; slot++)
+	{
+		id[slot] = fresh++;
+		m_slotOf[id[slot]] = slot;
+	}
+	return first;
+}
+
+void ParticleStore::remove(int particleId)
+{
+	int slot = slotOf(particleId);
+	if (slot == -1)
+		return;
+
+	int last = size() - 1;
+	if (slot != last)
+		_move(last, slot);
+	_popBack();
+	m_slotOf[particleId] = -1;
+	m_generation[particleId]++;
+	m_freeIds.push_back(particleId);
+	std::push_heap(m_freeIds.begin(), m_freeIds.end(), std::greater<int>());
+}
+
+void ParticleStore::reserve(int count)
+{
+	x.reserve(count);
+	y.reserve(count);
+	vx.reserve(count);
+	vy.reserve(count);
+	fx.reserve(count);
+	fy.reserve(count);
+	ax.reserve(count);
+	ay.reserve(count);
+	mass.reserve(count);
+	invMass.reserve(count);
+	radius.reserve(count);
+	id.reserve(count);
+	color.reserve(count);
+	active.reserve(count);
+	m_slotOf.reserve(count);
+	m_generation.reserve(count);
+	m_freeIds.reserve(count);
+}
+
+void ParticleStore::reindex(int idCount)
+{
+	m_slotOf.assign(idCount, -1);
+	for (int slot = 0; slot < size(); slot++)
+		m_slotOf[id[slot]] = slot;
+
+	// Handles into the previous particles must not match the new ones
+	m_generation.resize(idCount, 0);
+	for (std::uint32_t& generation : m_generation)
+		generation++;
+
+	// Ascending ids already form a min heap
+	m_freeIds.clear();
+	for (int i = 0; i < idCount; i++)
+		if (m_slotOf[i] == -1)
+			m_freeIds.push_back(i);
+}
+
+void ParticleStore::_move(int from, int to)
+{
+	x[to] = x[from];
+	y[to] = y[from];
+	vx[to] = vx[from];
+	vy[to] = vy[from];
+	fx[to] = fx[from];
+	fy[to] = fy[from];
+	ax[to] = ax[from];
+	ay[to] = ay[from];
+	mass[to] = mass[from];
+	invMass[to] = invMass[from];
+	radius[to] = radius[from];
+	id[to] = id[from];
+	color[to] = color[from];
+	active[to] = active[from];
+
+	m_slotOf[id[to]] = to;
+}
+
+void ParticleStore::_popBack()
+{
+	x.pop_back();
+	y.pop_back();
+	vx.pop_back();
+	vy.pop_back();
+	fx.pop_back();
+	fy.pop_back();
+	ax.pop_back();
+	ay.pop_back();
+	mass.pop_back();
+	invMass.pop_back();
+	radius.pop_back();
+	id.pop_back();
+	color.pop_back();
+	active.pop_back();
+}
@@ -0,0 +1,126 @@
+/*
+* Structure of arrays storage for every particle in a universe.
+* Hot physics fields live in their own contiguous arrays indexed by slot.
+* Slots are dense and change when particles are removed, ids are stable
+* while a particle lives. Ids of removed particles are reused, lowest
+* first, so every id array stays bounded by the peak particle count and
+* steady creation and removal never grows one. Every reuse bumps the
+* id's generation so handles to the removed particle can tell.
+* @author Dominick Dimpfel
+* @date 02/08/2024
+*/
+#ifndef PARTICLESTORE_H
+#define PARTICLESTORE_H
+#include <cstdint>
+#include <vector>
+#include "ParticleColor.h"
+
+#define PARTICLE_MASS			1.f
+#define RADIUS_TO_MASS_RATIO	1.f
+
+class ParticleStore
+{
+public:
+	// Hot fields
+	std::vector<float> x, y;
+	std::vector<float> vx, vy;
+	std::vector<float> fx, fy;
+	std::vector<float> ax, ay;
+	std::vector<float> mass, invMass;
+	std::vector<float> radius;
+
+	// Cold fields
+	std::vector<int> id;
+	std::vector<ParticleColor> color;
+	std::vector<unsigned char> active;
+
+private:
+	// id -> slot, -1 when id is not alive
+	std::vector<int> m_slotOf;
+	std::vector<std::uint32_t> m_generation;
+	// Dead ids as a min heap
+	std::vector<int> m_freeIds;
+
+public:
+	ParticleStore() = default;
+	~ParticleStore() = default;
+
+	/*
+	* Append particle with default state under the lowest free id,
+	* read it back from id[slot]
+	* @return slot of new particle
+	*/
+	int add();
+
+	/*
+	* Append count particles with default state at once. Ids are taken
+	* like count calls to add() would, a contiguous range when no id is
+	* free.
+	* @return slot of the first new particle, the others follow it
+	*/
+	int add(int count);
+
+	/*
+	* Remove particle by id, last slot is moved into its place and the id
+	* is free for the next add
+	*/
+	void remove(int particleId);
+
+	/*
+	* Reserve room for count particles in every array
+	*/
+	void reserve(int count);
+
+	/*
+	* Rebuild the id to slot index and free ids after the arrays were
+	* filled in bulk, ids run below idCount. Every generation is bumped.
+	*/
+	void reindex(int idCount);
+
+	/*
+	* Set mass and keep inverse mass in sync
+	*/
+	void setMass(int slot, float m)
+	{
+		mass[slot] = m;
+		invMass[slot] = m != 0.0f ? 1 / m : 0.0f;
+	}
+
+	/*
+	* @return slot of id or -1 if id is not alive
+	*/
+	int slotOf(int particleId) const
+	{
+		return particleId >= 0 && particleId < static_cast<int>(m_slotOf.size()) ? m_slotOf[particleId] : -1;
+	}
+
+	bool contains(int particleId) const		{ return slotOf(particleId) != -1; }
+
+	/*
+	* Times particleId was reused, a handle is stale once this changes
+	*/
+	std::uint32_t generationOf(int particleId) const
+	{
+		return particleId >= 0 && particleId < idCount() ? m_generation[particleId] : 0;
+	}
+
+	/*
+	* Ids issued so far, every id alive or free is below this
+	*/
+	int idCount() const						{ return static_cast<int>(m_slotOf.size()); }
+	int size() const						{ return static_cast<int>(id.size()); }
+	bool empty() const						{ return id.empty(); }
+
+private:
+	/*
+	* Move everything in slot from to slot to
+	*/
+	void _move(int from, int to);
+
+	/*
+	* Drop last slot from every array
+	*/
+	void _popBack();
+};
+
+#endif // !PARTICLESTORE_H
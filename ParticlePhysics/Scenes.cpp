@@ -0,0 +1,100 @@
+/*
+* Scene generators shared by the window and headless runners
+* @author Dominick Dimpfel
+* @date 02/14/2024
+*/
+
+#include "Scenes.h"
+#include <cstdlib>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include "Vec2f.h"
+#include "Universe.h"
+
+void setupCircularOrbits(Universe& u, const Vec2f& CENTER, float CENTER_MASS, float CENTER_RADIUS, float MAX_RADIUS, int count) {
+	Particle sun = u.createParticle(CENTER, Vec2f(), CENTER_MASS, CENTER_RADIUS);
+	sun.setColor(253, 184, 19);
+	float sunRadius = sun.getRadius();
+
+	u.createParticles(count - 1, [&](int, ParticleDesc& p)
+	{
+		auto distance = static_cast<float>(rand() % static_cast<int>(MAX_RADIUS)) + sunRadius * 1.2f;
+		float angle = static_cast<float>(rand()) / RAND_MAX * 2 * PI;
+		p.position = Vec2f(distance * cos(angle), distance * sin(angle)) + CENTER;
+
+		float speed = sqrt(G_CONSTANT * CENTER_MASS / distance);
+		p.velocity = Vec2f(-speed * sin(angle), speed * cos(angle));
+
+		p.mass = rand() % 2 + .5f;
+		p.radius = p.mass * RADIUS_TO_MASS_RATIO;
+		p.color = ParticleColor(rand() % 255, rand() % 255, rand() % 255);
+	});
+}
+
+void setupDiskOfParticles(Universe& u, const Vec2f& CENTER, float MAX_RADIUS, int count) {
+	u.createParticles(count, [&](int, ParticleDesc& p)
+	{
+		auto distance = static_cast<float>(rand() % static_cast<int>(MAX_RADIUS) + 1);
+		float angle = static_cast<float>(rand()) / RAND_MAX * 2 * PI;
+		p.position = Vec2f(distance * cos(angle), distance * sin(angle)) + CENTER;
+
+		float speed = sqrt(G_CONSTANT * PARTICLE_MASS / distance);
+		p.velocity = Vec2f(-speed * sin(angle), speed * cos(angle));
+
+		p.color = ParticleColor(rand() % 255, rand() % 255, rand() % 255);
+	});
+}
+
+// Uniform in [0, 1) from seed, particle index and draw, stateless so
+// particles can be generated on any thread in any order
+static float hashUniform(unsigned int seed, int index, int draw)
+{
+	std::uint64_t h = (static_cast<std::uint64_t>(seed) << 32) ^
+		(static_cast<std::uint64_t>(static_cast<std::uint32_t>(index)) << 3) ^ static_cast<std::uint64_t>(draw);
+	h += 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return static_cast<float>(h >> 40) / 16777216.f;
+}
+
+void setupProceduralDisk(Universe& u, const Vec2f& CENTER, float MAX_RADIUS, unsigned int seed, int count) {
+	u.createParticles(count, [&](int i, ParticleDesc& p)
+	{
+		float distance = std::floor(hashUniform(seed, i, 0) * MAX_RADIUS) + 1;
+		float angle = hashUniform(seed, i, 1) * 2 * PI;
+		p.position = Vec2f(distance * cos(angle), distance * sin(angle)) + CENTER;
+
+		float speed = sqrt(G_CONSTANT * PARTICLE_MASS / distance);
+		p.velocity = Vec2f(-speed * sin(angle), speed * cos(angle));
+
+		p.color = ParticleColor(static_cast<int>(hashUniform(seed, i, 2) * 255),
+			static_cast<int>(hashUniform(seed, i, 3) * 255), static_cast<int>(hashUniform(seed, i, 4) * 255));
+	}, true);
+}
+
+void setupRandomDispersion(Universe& u, int width, int height, int count) {
+	u.createParticles(count, [&](int, ParticleDesc& p)
+	{
+		p.position = Vec2f(rand() % width, rand() % height);
+		p.color = ParticleColor(rand() % 255, rand() % 255, rand() % 255);
+		p.mass = 10.f;
+	});
+}
+
+bool setupNamedScene(Universe& u, const std::string& name, int count)
+{
+	const Vec2f CENTER = Vec2f(WIDTH / 2, HEIGHT / 2);
+	if (name == "disk")
+		setupDiskOfParticles(u, CENTER, 250.f, count);
+	else if (name == "orbits")
+		setupCircularOrbits(u, CENTER, 3'000.f, 50.f, 300.f, count);
+	else if (name == "random")
+		setupRandomDispersion(u, WIDTH, HEIGHT, count);
+	else if (name == "procedural")
+		setupProceduralDisk(u, CENTER, 250.f, static_cast<unsigned int>(rand()), count);
+	else
+		return false;
+	return true;
+}
@@ -0,0 +1,45 @@
+/*
+* Scene generators shared by the window and headless runners
+* @author Dominick Dimpfel
+* @date 02/14/2024
+*/
+#ifndef SCENES_H
+#define SCENES_H
+#include <string>
+#include "Vec2f.h"
+#include "Universe.h"
+
+#define	WIDTH		1200
+#define HEIGHT		675
+#define DELTA_TIME	100.f
+
+/*
+* Heavy sun at CENTER with count - 1 particles on circular orbits
+*/
+void setupCircularOrbits(Universe& u, const Vec2f& CENTER, float CENTER_MASS, float CENTER_RADIUS, float MAX_RADIUS,
+	int count = UNIVERSE_CAPACITY);
+
+/*
+* Dense rotating disk of equal particles around CENTER
+*/
+void setupDiskOfParticles(Universe& u, const Vec2f& CENTER, float MAX_RADIUS, int count = UNIVERSE_CAPACITY);
+
+/*
+* Same distribution as the disk but drawn from a hash of seed and index
+* instead of rand, so it is generated in parallel on the universe's pool
+*/
+void setupProceduralDisk(Universe& u, const Vec2f& CENTER, float MAX_RADIUS, unsigned int seed, int count = UNIVERSE_CAPACITY);
+
+/*
+* Resting particles spread uniformly over width x height
+*/
+void setupRandomDispersion(Universe& u, int width, int height, int count = UNIVERSE_CAPACITY);
+
+/*
+* Set up scene "disk", "orbits", "random" or "procedural" with the
+* parameters the runners share, procedural takes its seed from rand
+* @return false if the name is unknown
+*/
+bool setupNamedScene(Universe& u, const std::string& name, int count = UNIVERSE_CAPACITY);
+
+#endif // !SCENES_H
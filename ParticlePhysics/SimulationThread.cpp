@@ -0,0 +1,79 @@
+/*
+* Simulation thread publishing render frames through a triple buffer
+* @author Dominick Dimpfel
+* @date 03/04/2024
+*/
+
+#include "SimulationThread.h"
+#include <algorithm>
+#include <chrono>
+
+void RenderFrame::capture(int step, const ParticleStore& ps)
+{
+	this->step = step;
+	x.assign(ps.x.begin(), ps.x.end());
+	y.assign(ps.y.begin(), ps.y.end());
+	radius.assign(ps.radius.begin(), ps.radius.end());
+	color.assign(ps.color.begin(), ps.color.end());
+}
+
+void SimulationThread::start(float deltaTime, int stepsPerSecond, long long maxSteps)
+{
+	stop();
+	m_deltaTime = deltaTime;
+	m_stepsPerSecond = stepsPerSecond;
+	m_maxSteps = maxSteps;
+	m_stop = false;
+	m_finished = false;
+	m_steps = 0;
+	m_seconds = 0.0;
+	m_maxPublishSeconds = 0.0;
+
+	// The renderer has a frame before the first step ends
+	m_frames.back().capture(m_universe.getStepCount(), m_universe.getStore());
+	m_frames.publish();
+	m_thread = std::thread(&SimulationThread::_run, this);
+}
+
+void SimulationThread::stop()
+{
+	m_stop = true;
+	join();
+}
+
+void SimulationThread::join()
+{
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void SimulationThread::_run()
+{
+	using Clock = std::chrono::steady_clock;
+	Clock::time_point start = Clock::now();
+	Clock::duration period = m_stepsPerSecond > 0
+		? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_stepsPerSecond))
+		: Clock::duration::zero();
+
+	long long steps = 0;
+	while (!m_stop && (m_maxSteps == 0 || steps < m_maxSteps))
+	{
+		m_universe.update(m_deltaTime);
+		if (m_onStep)
+			m_onStep(m_universe);
+
+		// Copying the frame is the producer's work, only publish touches
+		// state shared with the renderer
+		Clock::time_point publishStart = Clock::now();
+		m_frames.back().capture(m_universe.getStepCount(), m_universe.getStore());
+		m_frames.publish();
+		m_maxPublishSeconds = std::max(m_maxPublishSeconds,
+			std::chrono::duration<double>(Clock::now() - publishStart).count());
+
+		m_steps = ++steps;
+		if (period != Clock::duration::zero())
+			std::this_thread::sleep_until(start + period * steps);
+	}
+	m_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	m_finished = true;
+}
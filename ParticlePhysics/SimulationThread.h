@@ -0,0 +1,110 @@
+/*
+* Steps a Universe on its own thread and publishes what the renderer needs
+* of every step through a TripleBuffer, so rendering and physics run at
+* their own rates. The renderer takes the latest RenderFrame with acquire()
+* and never blocks, the simulation thread never waits on the renderer.
+* The Universe belongs to the simulation thread between start and stop.
+* @author Dominick Dimpfel
+* @date 03/04/2024
+*/
+#ifndef SIMULATIONTHREAD_H
+#define SIMULATIONTHREAD_H
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "ParticleColor.h"
+#include "ParticleStore.h"
+#include "TripleBuffer.h"
+#include "Universe.h"
+
+/*
+* Immutable copy of the drawn columns after one step, laid out like
+* ParticleStore so ParticleBatch fills from either
+*/
+struct RenderFrame
+{
+	int step = 0;
+	std::vector<float> x, y;
+	std::vector<float> radius;
+	std::vector<ParticleColor> color;
+
+	int size() const					{ return static_cast<int>(x.size()); }
+
+	/*
+	* Copy the columns of ps, reusing the capacity of earlier frames
+	*/
+	void capture(int step, const ParticleStore& ps);
+};
+
+class SimulationThread
+{
+private:
+	Universe& m_universe;
+	TripleBuffer<RenderFrame> m_frames;
+	std::thread m_thread;
+	std::function<void(const Universe&)> m_onStep;
+
+	float m_deltaTime = 0.f;
+	int m_stepsPerSecond = 0;
+	long long m_maxSteps = 0;
+	std::atomic<bool> m_stop{ false };
+	std::atomic<bool> m_finished{ false };
+	std::atomic<long long> m_steps{ 0 };
+
+	// Written by the simulation thread, read after stop
+	double m_seconds = 0.0;
+	double m_maxPublishSeconds = 0.0;
+
+public:
+	explicit SimulationThread(Universe& u) : m_universe(u) {}
+	~SimulationThread()					{ stop(); }
+	SimulationThread(const SimulationThread&) = delete;
+	SimulationThread& operator=(const SimulationThread&) = delete;
+
+	/*
+	* Called on the simulation thread after every step, before the frame
+	* is published. Set before start.
+	*/
+	void setOnStep(const std::function<void(const Universe&)>& onStep)	{ m_onStep = onStep; }
+
+	/*
+	* Publish the current state and start stepping by deltaTime.
+	* stepsPerSecond paces the steps in wall time, 0 steps as fast as
+	* possible. maxSteps ends the thread after that many steps, 0 runs
+	* until stop.
+	*/
+	void start(float deltaTime, int stepsPerSecond = 0, long long maxSteps = 0);
+
+	/*
+	* Stop stepping after the current step and join the thread
+	*/
+	void stop();
+
+	/*
+	* Wait for maxSteps to be reached and join the thread
+	*/
+	void join();
+
+	bool isRunning() const				{ return m_thread.joinable(); }
+	bool isFinished() const				{ return m_finished; }
+	long long getSteps() const			{ return m_steps; }
+
+	/*
+	* Renderer side, acquire() moves the latest published frame to frame()
+	* @return true if frame() changed
+	*/
+	bool acquire()						{ return m_frames.acquire(); }
+	const RenderFrame& frame() const	{ return m_frames.front(); }
+
+	// Valid once the thread is joined
+	long long getFramesPublished() const	{ return m_frames.getPublished(); }
+	long long getFramesOverwritten() const	{ return m_frames.getOverwritten(); }
+	double getSeconds() const				{ return m_seconds; }
+	double getMaxPublishSeconds() const		{ return m_maxPublishSeconds; }
+
+private:
+	void _run();
+};
+
+#endif // !SIMULATIONTHREAD_H
@@ -0,0 +1,216 @@
+/*
+* Binary snapshot writer and memory mapped reader
+* @author Dominick Dimpfel
+* @date 02/28/2024
+*/
+
+#include "Snapshot.h"
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Files are read in place so the layout is part of the format
+static_assert(sizeof(SnapshotHeader) == 112 && sizeof(SnapshotSection) == 24,
+	"snapshot layout changed, bump SNAPSHOT_VERSION");
+
+static std::uint64_t alignUp(std::uint64_t offset)
+{
+	return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+bool SnapshotWriter::open(const std::string& path, const SnapshotHeader& header)
+{
+	m_out.open(path, std::ios::binary | std::ios::trunc);
+	if (!m_out)
+		return false;
+
+	m_header = header;
+	m_header.fields = 0;
+	m_header.sectionCount = 0;
+
+	// Placeholder for header and table, rewritten by finish
+	m_offset = alignUp(sizeof(SnapshotHeader) + sizeof(m_sections));
+	static const char zeros[SNAPSHOT_ALIGNMENT] = {};
+	for (std::uint64_t i = 0; i < m_offset; i += SNAPSHOT_ALIGNMENT)
+		m_out.write(zeros, SNAPSHOT_ALIGNMENT);
+	return static_cast<bool>(m_out);
+}
+
+bool SnapshotWriter::addSection(SnapshotField field, const void* data, std::size_t elementSize, std::int64_t count)
+{
+	if (m_header.sectionCount == SNAPSHOT_MAX_SECTIONS || (m_header.fields & field))
+		return false;
+
+	SnapshotSection& section = m_sections[m_header.sectionCount++];
+	section.field = field;
+	section.elementSize = static_cast<std::uint32_t>(elementSize);
+	section.offset = m_offset;
+	section.bytes = static_cast<std::uint64_t>(elementSize) * static_cast<std::uint64_t>(count);
+	m_header.fields |= field;
+
+	m_out.write(static_cast<const char*>(data), static_cast<std::streamsize>(section.bytes));
+	m_offset += section.bytes;
+	_pad();
+	return static_cast<bool>(m_out);
+}
+
+bool SnapshotWriter::finish()
+{
+	std::memcpy(m_header.magic, SNAPSHOT_MAGIC, sizeof(m_header.magic));
+	m_header.version = SNAPSHOT_VERSION;
+	m_header.byteOrder = SNAPSHOT_BYTE_ORDER;
+
+	m_out.seekp(0);
+	m_out.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+	m_out.write(reinterpret_cast<const char*>(m_sections), sizeof(SnapshotSection) * m_header.sectionCount);
+	m_out.close();
+	return !m_out.fail();
+}
+
+void SnapshotWriter::_pad()
+{
+	static const char zeros[SNAPSHOT_ALIGNMENT] = {};
+	std::uint64_t next = alignUp(m_offset);
+	m_out.write(zeros, static_cast<std::streamsize>(next - m_offset));
+	m_offset = next;
+}
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	m_file = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		close();
+		return false;
+	}
+	m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_mapping)
+	{
+		close();
+		return false;
+	}
+	m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+	m_file = ::open(path.c_str(), O_RDONLY);
+	if (m_file == -1)
+		return false;
+
+	struct stat info;
+	if (fstat(m_file, &info) != 0 || info.st_size == 0)
+	{
+		close();
+		return false;
+	}
+	void* data = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, m_file, 0);
+	if (data == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+	// Snapshots are read front to back once
+	madvise(data, static_cast<std::size_t>(info.st_size), MADV_SEQUENTIAL);
+	m_data = static_cast<const unsigned char*>(data);
+	m_size = static_cast<std::size_t>(info.st_size);
+#endif
+	if (!m_data)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file)
+		CloseHandle(m_file);
+	m_mapping = nullptr;
+	m_file = nullptr;
+#else
+	if (m_data)
+		munmap(const_cast<unsigned char*>(m_data), m_size);
+	if (m_file != -1)
+		::close(m_file);
+	m_file = -1;
+#endif
+	m_data = nullptr;
+	m_size = 0;
+}
+
+bool SnapshotReader::open(const std::string& path)
+{
+	m_header = nullptr;
+	m_sections = nullptr;
+	if (!m_file.open(path))
+		return false;
+
+	const unsigned char* data = m_file.data();
+	std::size_t size = m_file.size();
+	if (size < sizeof(SnapshotHeader))
+		return false;
+
+	// Mappings are page aligned so the header and table can be used in place
+	const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(data);
+	if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != SNAPSHOT_VERSION || header->byteOrder != SNAPSHOT_BYTE_ORDER ||
+		header->sectionCount > SNAPSHOT_MAX_SECTIONS || header->count < 0 ||
+		size < sizeof(SnapshotHeader) + sizeof(SnapshotSection) * header->sectionCount)
+		return false;
+
+	// Every section is one known field, once, and together they are
+	// exactly the claimed field mask
+	const SnapshotSection* sections = reinterpret_cast<const SnapshotSection*>(data + sizeof(SnapshotHeader));
+	std::uint32_t fields = 0;
+	for (std::uint32_t i = 0; i < header->sectionCount; i++)
+	{
+		const SnapshotSection& s = sections[i];
+		bool singleField = s.field != 0 && (s.field & (s.field - 1)) == 0 && (s.field & ~SNAPSHOT_ALL) == 0;
+		if (!singleField || (fields & s.field) || s.offset > size || s.bytes > size - s.offset ||
+			s.bytes != static_cast<std::uint64_t>(s.elementSize) * static_cast<std::uint64_t>(header->count))
+			return false;
+		fields |= s.field;
+	}
+	if (fields != header->fields)
+		return false;
+
+	m_header = header;
+	m_sections = sections;
+	return true;
+}
+
+const void* SnapshotReader::section(SnapshotField field, std::size_t elementSize) const
+{
+	for (std::uint32_t i = 0; i < m_header->sectionCount; i++)
+	{
+		const SnapshotSection& s = m_sections[i];
+		if (s.field == field)
+			return s.elementSize == elementSize ? m_file.data() + s.offset : nullptr;
+	}
+	return nullptr;
+}
@@ -0,0 +1,189 @@
+/*
+* Binary snapshot format for a universe. A fixed header and a section
+* table are followed by one raw array per particle field, every array
+* starts on a SNAPSHOT_ALIGNMENT boundary so a memory mapped file can be
+* copied straight into the store without parsing. Files are in host byte
+* order, the header records it so foreign files are rejected.
+* A snapshot can hold a subset of the fields. Ids are always written, a
+* partial snapshot only loads over a universe holding the same ids in
+* the same slots, which lets runs checkpoint only what changes.
+* @author Dominick Dimpfel
+* @date 02/28/2024
+*/
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+#define SNAPSHOT_MAGIC			"PPSNAP\r\n"
+#define SNAPSHOT_VERSION		1
+#define SNAPSHOT_BYTE_ORDER		0x01020304u
+#define SNAPSHOT_ALIGNMENT		64
+#define SNAPSHOT_MAX_SECTIONS	32
+
+/*
+* Particle fields as bits of a snapshot field mask
+*/
+enum SnapshotField : std::uint32_t
+{
+	SNAPSHOT_X			= 1u << 0,
+	SNAPSHOT_Y			= 1u << 1,
+	SNAPSHOT_VX			= 1u << 2,
+	SNAPSHOT_VY			= 1u << 3,
+	SNAPSHOT_FX			= 1u << 4,
+	SNAPSHOT_FY			= 1u << 5,
+	SNAPSHOT_AX			= 1u << 6,
+	SNAPSHOT_AY			= 1u << 7,
+	SNAPSHOT_MASS		= 1u << 8,
+	SNAPSHOT_INV_MASS	= 1u << 9,
+	SNAPSHOT_RADIUS		= 1u << 10,
+	SNAPSHOT_ID			= 1u << 11,
+	SNAPSHOT_COLOR		= 1u << 12,
+	SNAPSHOT_ACTIVE		= 1u << 13,
+
+	// Everything that changes while stepping without merges
+	SNAPSHOT_MOTION		= SNAPSHOT_X | SNAPSHOT_Y | SNAPSHOT_VX | SNAPSHOT_VY |
+		SNAPSHOT_FX | SNAPSHOT_FY | SNAPSHOT_AX | SNAPSHOT_AY,
+	SNAPSHOT_ALL		= (1u << 14) - 1
+};
+
+/*
+* Universe state besides the particle arrays
+*/
+struct SnapshotHeader
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t byteOrder;
+	std::uint32_t fields;			// SnapshotField mask of the sections present
+	std::uint32_t sectionCount;
+	std::int64_t count;				// particles
+	std::int32_t idCount;			// ids issued, the free ones are reused lowest first
+	std::int32_t stepCount;
+
+	// Collision grid
+	float gridOriginX, gridOriginY;
+	float gridExtentsX, gridExtentsY;
+	float gridCellX, gridCellY;
+	std::int32_t gridRows, gridCols;
+	std::int32_t gridMode;
+	std::int32_t gridAutoTune;
+
+	// Solver settings
+	std::int32_t gravitySolver;
+	std::int32_t integrator;
+	std::int32_t contactIterations;
+	float gravityCutoff;
+	float barnesHutTheta;
+	std::int32_t multipoleOrder;
+	std::int32_t meshSize;
+	std::int32_t blockForcesValid;	// saved accelerations are current for block steps
+};
+
+struct SnapshotSection
+{
+	std::uint32_t field;			// single SnapshotField bit
+	std::uint32_t elementSize;
+	std::uint64_t offset;			// from the start of the file
+	std::uint64_t bytes;
+};
+
+/*
+* Streams a snapshot. The header and section table are reserved up front
+* and written last, arrays go to the file as they are added.
+*/
+class SnapshotWriter
+{
+private:
+	std::ofstream m_out;
+	SnapshotHeader m_header;
+	SnapshotSection m_sections[SNAPSHOT_MAX_SECTIONS];
+	std::uint64_t m_offset = 0;
+
+public:
+	SnapshotWriter() = default;
+	~SnapshotWriter() = default;
+
+	/*
+	* Open path for writing, the header's magic, version, byte order,
+	* fields and section count are filled in by finish
+	*/
+	bool open(const std::string& path, const SnapshotHeader& header);
+
+	/*
+	* Append the array of field, count elements of elementSize bytes
+	*/
+	bool addSection(SnapshotField field, const void* data, std::size_t elementSize, std::int64_t count);
+
+	/*
+	* Write header and section table and close the file
+	*/
+	bool finish();
+
+private:
+	/*
+	* Zero fill up to the next SNAPSHOT_ALIGNMENT boundary
+	*/
+	void _pad();
+};
+
+/*
+* Read only memory map of a whole file, unmapped on close or destruction
+*/
+class MappedFile
+{
+private:
+	const unsigned char* m_data = nullptr;
+	std::size_t m_size = 0;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#else
+	int m_file = -1;
+#endif
+
+public:
+	MappedFile() = default;
+	~MappedFile()						{ close(); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+
+	const unsigned char* data() const	{ return m_data; }
+	std::size_t size() const			{ return m_size; }
+};
+
+/*
+* Validated view of a mapped snapshot
+*/
+class SnapshotReader
+{
+private:
+	MappedFile m_file;
+	const SnapshotHeader* m_header = nullptr;
+	const SnapshotSection* m_sections = nullptr;
+
+public:
+	SnapshotReader() = default;
+	~SnapshotReader() = default;
+
+	/*
+	* Map path and check magic, version, byte order and that every section
+	* lies inside the file
+	*/
+	bool open(const std::string& path);
+
+	const SnapshotHeader& header() const	{ return *m_header; }
+
+	/*
+	* Array of field or nullptr when the snapshot does not hold it or its
+	* element size differs from elementSize
+	*/
+	const void* section(SnapshotField field, std::size_t elementSize) const;
+};
+
+#endif // !SNAPSHOT_H
@@ -5,140 +5,444 @@
 */
 
 #include "SpatialHashGrid.h"
-#include <set>
-#include <map>
 #include <vector>
-#include <string>
+#include <algorithm>
+#include <cmath>
+#include <utility>
 #include "Vec2f.h"
+#include "CellTable.h"
 
 void SpatialHashGrid::addClient(int id, const Vec2f& position, float radius)
 {
-	Vec2f min = { position.x - radius - m_origin.x, position.y - radius - m_origin.y };
-	Vec2f max = { position.x + radius - m_origin.x, position.y + radius - m_origin.y };
+	_reserveClient(id);
+	Client& cli = m_clients[id];
+	cli.id = id;
+	cli.position = position;
+	cli.radius = radius;
+	_getBounds(position, radius, cli.min, cli.max);
+	_place(id);
+}
+
+void SpatialHashGrid::_place(int i)
+{
+	Client& cli = m_clients[i];
+	cli.large = _isLarge(cli.min, cli.max);
+	if (cli.large)
+	{
+		m_large.push_back(i);
+		return;
+	}
+
+	if (m_mode == GridMode::REBUILD)
+	{
+		m_dirty = true;
+		return;
+	}
+	_insert(i);
+}
+
+void SpatialHashGrid::_unplace(int i)
+{
+	Client& cli = m_clients[i];
+	if (cli.large)
+	{
+		auto it = std::find(m_large.begin(), m_large.end(), i);
+		if (it != m_large.end())
+			m_large.erase(it);
+		cli.large = false;
+		return;
+	}
+	remove(i);
+	if (m_mode == GridMode::REBUILD)
+		m_dirty = true;
+}
 
-	Client cli = Client(id);
-	_getCellIndex(min, cli.min);
-	_getCellIndex(max, cli.max);
+void SpatialHashGrid::_getBounds(const Vec2f& position, float radius, int* min, int* max) const
+{
+	Vec2f lo = { position.x - radius - m_origin.x, position.y - radius - m_origin.y };
+	Vec2f hi = { position.x + radius - m_origin.x, position.y + radius - m_origin.y };
+	_getCellIndex(lo, min);
+	_getCellIndex(hi, max);
+}
+
+bool SpatialHashGrid::_isLarge(const int* min, const int* max) const
+{
+	long long rows = static_cast<long long>(max[0]) - min[0] + 1;
+	long long cols = static_cast<long long>(max[1]) - min[1] + 1;
+	return rows * cols > GRID_LARGE_OBJECT_CELLS;
+}
 
+void SpatialHashGrid::_insert(int i)
+{
+	const Client& cli = m_clients[i];
 	for (int r = cli.min[0]; r <= cli.max[0]; r++)
 	{
 		for (int c = cli.min[1]; c <= cli.max[1]; c++)
 		{
-			std::string cell = _key(r, c);
-			m_cells[cell].insert(id);
+			m_cells.insert(r, c, i);
 		}
 	}
 }
 
 void SpatialHashGrid::_getCellIndex(const Vec2f& position, int* b) const
 {
-	// infinite?
-	float r = (position.y - m_origin.y) / m_cellDims.y;
-	float c = (position.x - m_origin.x) / m_cellDims.x;
+	// Floor so cells left of and above the origin get negative indices
+	// instead of folding into cell 0, clamp so far away particles stay in int range
+	float r = std::floor((position.y - m_origin.y) / m_cellDims.y);
+	float c = std::floor((position.x - m_origin.x) / m_cellDims.x);
 
-	b[0] = static_cast<int>(r);
-	b[1] = static_cast<int>(c);
+	b[0] = static_cast<int>(std::max(-GRID_CELL_LIMIT, std::min(r, GRID_CELL_LIMIT)));
+	b[1] = static_cast<int>(std::max(-GRID_CELL_LIMIT, std::min(c, GRID_CELL_LIMIT)));
+}
 
-	// simon dev way
-	//float r = std::min(std::max((position.y - m_origin.y) / (m_extents.y - m_origin.y), 0.0f), 1.0f);
-	//float c = std::min(std::max((position.x - m_origin.x) / (m_extents.x - m_origin.x), 0.0f), 1.0f);
+void SpatialHashGrid::_reserveClient(int id)
+{
+	if (id < static_cast<int>(m_clients.size()))
+		return;
 
-	//b[0] = std::floor(r * (m_rows - 1));
-	//b[1] = std::floor(c * (m_cols - 1));
+	size_t size = std::max(static_cast<size_t>(id) + 1, m_clients.size() * 2);
+	m_clients.resize(size);
+	m_stamps.resize(size, 0);
 }
 
-void SpatialHashGrid::update(int i, const Vec2f& position, float radius)
+void SpatialHashGrid::_beginQuery()
 {
-	Vec2f min = { position.x - radius - m_origin.x, position.y - radius - m_origin.y };
-	Vec2f max = { position.x + radius - m_origin.x, position.y + radius - m_origin.y };
-	 
-	int iMin[2], iMax[2]; 
-	_getCellIndex(min, iMin);
-	_getCellIndex(max, iMax);
+	// Stamps are only reset when the counter wraps around
+	if (++m_query == 0)
+	{
+		std::fill(m_stamps.begin(), m_stamps.end(), 0);
+		m_query = 1;
+	}
+}
+
+void SpatialHashGrid::_collect(int r, int c, std::vector<int>& results)
+{
+	int cell = m_cells.findIndex(r, c);
+	if (cell != -1)
+		_collectCell(cell, results);
+}
+
+void SpatialHashGrid::_collectCell(int cell, std::vector<int>& results)
+{
+	if (m_mode == GridMode::REBUILD)
+	{
+		if (cell + 1 >= static_cast<int>(m_cellStart.size())) return;
+
+		for (int k = m_cellStart[cell]; k < m_cellStart[cell + 1]; k++)
+		{
+			int id = m_sorted[k];
+			// Deleted since last rebuild
+			if (m_clients[id].id == -1 || m_stamps[id] == m_query) continue;
+			m_stamps[id] = m_query;
+			results.push_back(id);
+		}
+		return;
+	}
+
+	for (int id : m_cells.bucket(cell))
+	{
+		if (m_stamps[id] == m_query) continue;
+		m_stamps[id] = m_query;
+		results.push_back(id);
+	}
+}
+
+bool SpatialHashGrid::update(int i, const Vec2f& position, float radius)
+{
+	int iMin[2], iMax[2];
+	_getBounds(position, radius, iMin, iMax);
 
 	Client& cli = m_clients[i];
-	//std::cout << i << std::endl;
-	//std::cout << cli.min[0] << " " << cli.min[1] << " min" << std::endl;
-	//std::cout << cli.max[0] << " " << cli.max[1] << " max" << std::endl;
+	cli.position = position;
+	cli.radius = radius;
 
 	if (cli.min[0] == iMin[0] &&
 		cli.min[1] == iMin[1] &&
 		cli.max[0] == iMax[0] &&
 		cli.max[1] == iMax[1])
-		return;
-
-	remove(i);
+		return false;
 
-	cli.min[0] = iMin[0];
-	cli.min[1] = iMin[1];
-	cli.max[0] = iMax[0];
-	cli.max[1] = iMax[1];
-	for (int r = cli.min[0]; r <= cli.max[0]; r++)
+	// Large clients only move between lists when their size class changes
+	bool large = _isLarge(iMin, iMax);
+	if (cli.large && large)
 	{
-		for (int c = cli.min[1]; c <= cli.max[1]; c++)
-		{
-			std::string cell = _key(r, c);
-			m_cells[cell].insert(i);
-		}
+		std::copy(iMin, iMin + 2, cli.min);
+		std::copy(iMax, iMax + 2, cli.max);
+		return true;
 	}
+
+	_unplace(i);
+	std::copy(iMin, iMin + 2, cli.min);
+	std::copy(iMax, iMax + 2, cli.max);
+	_place(i);
+	return true;
 }
 
 void SpatialHashGrid::remove(int i)
 {
+	// Cells are refilled from client bounds on rebuild
+	if (m_mode == GridMode::REBUILD)
+		return;
+
 	Client& cli = m_clients[i];
+	if (cli.large)
+		return;
+
 	for (int r = cli.min[0]; r <= cli.max[0]; r++)
 	{
 		for (int c = cli.min[1]; c <= cli.max[1]; c++)
 		{
-			std::string cell = _key(r, c);
-			m_cells[cell].erase(i);
+			// Empty cells are erased by the table
+			m_cells.remove(r, c, i);
 		}
 	}
 }
 
 void SpatialHashGrid::deleteClient(int i)
 {
-	remove(i);
-	m_clients.erase(i);
+	_unplace(i);
+	m_clients[i] = Client();
 }
 
-std::set<int> SpatialHashGrid::findNear(const Vec2f& position, float radius, std::set<int>& results)
+void SpatialHashGrid::findNear(const Vec2f& position, float radius, std::vector<int>& results)
 {
-	Vec2f min = { position.x - radius - m_origin.x, position.y - radius - m_origin.y };
-	Vec2f max = { position.x + radius - m_origin.x, position.y + radius - m_origin.y };
-
 	int iMin[2], iMax[2];
-	_getCellIndex(min, iMin);
-	_getCellIndex(max, iMax);
+	_getBounds(position, radius, iMin, iMax);
+
+	rebuild();
+	_beginQuery();
+	_collectRange(iMin, iMax, results);
+	_collectLarge(iMin, iMax, results);
+}
 
-	for (int r = iMin[0]; r <= iMax[0]; r++)
+void SpatialHashGrid::findNear(int i, std::vector<int>& results)
+{
+	rebuild();
+	const Client& cli = m_clients[i];
+
+	_beginQuery();
+	_collectRange(cli.min, cli.max, results);
+	_collectLarge(cli.min, cli.max, results);
+}
+
+void SpatialHashGrid::findPairs(std::vector<std::pair<int, int>>& pairs)
+{
+	rebuild();
+
+	int r, c;
+	for (int cell = 0; cell < m_cells.size(); cell++)
 	{
-		for (int c = iMin[1]; c <= iMax[1]; c++)
+		m_cells.cellOf(cell, r, c);
+
+		if (m_mode == GridMode::REBUILD)
 		{
-			std::string cell = _key(r, c);
-			for (int id : m_cells[cell])
+			if (cell + 1 >= static_cast<int>(m_cellStart.size())) break;
+
+			// Ids in a rebuilt cell are ascending so pairs come out ordered
+			int end = m_cellStart[cell + 1];
+			for (int k = m_cellStart[cell]; k < end; k++)
 			{
-				results.insert(id);
+				int i = m_sorted[k];
+				if (m_clients[i].id == -1) continue;
+				for (int l = k + 1; l < end; l++)
+				{
+					int j = m_sorted[l];
+					if (m_clients[j].id == -1 || !_isFirstSharedCell(i, j, r, c)) continue;
+					pairs.emplace_back(i, j);
+				}
+			}
+			continue;
+		}
+
+		CellTable::Bucket bucket = m_cells.bucket(cell);
+		for (auto k = bucket.begin(); k != bucket.end(); ++k)
+		{
+			auto l = k;
+			for (++l; l != bucket.end(); ++l)
+			{
+				int i = *k, j = *l;
+				if (!_isFirstSharedCell(i, j, r, c)) continue;
+				pairs.emplace_back(std::min(i, j), std::max(i, j));
 			}
 		}
 	}
-	return results;
+
+	// Large clients are in no cell, pair each with the small clients in
+	// its range and with the large clients after it
+	for (size_t k = 0; k < m_large.size(); k++)
+	{
+		int i = m_large[k];
+		const Client& a = m_clients[i];
+
+		m_scratch.clear();
+		_beginQuery();
+		_collectRange(a.min, a.max, m_scratch);
+		for (int j : m_scratch)
+			pairs.emplace_back(std::min(i, j), std::max(i, j));
+
+		for (size_t l = k + 1; l < m_large.size(); l++)
+		{
+			int j = m_large[l];
+			if (_overlaps(a.min, a.max, m_clients[j].min, m_clients[j].max))
+				pairs.emplace_back(std::min(i, j), std::max(i, j));
+		}
+	}
 }
 
-std::set<int> SpatialHashGrid::findNear(int i, std::set<int>& results)
+void SpatialHashGrid::_collectRange(const int* min, const int* max, std::vector<int>& results)
 {
-	Client& cli = m_clients[i];
+	long long rows = static_cast<long long>(max[0]) - min[0] + 1;
+	long long cols = static_cast<long long>(max[1]) - min[1] + 1;
 
-	for (int r = cli.min[0]; r <= cli.max[0]; r++)
+	// Big ranges are cheaper to answer from the occupied cells
+	if (rows * cols > m_cells.size())
 	{
-		for (int c = cli.min[1]; c <= cli.max[1]; c++)
+		int cellMin[2] = { 0, 0 }, cellMax[2] = { 0, 0 };
+		for (int cell = 0; cell < m_cells.size(); cell++)
+		{
+			m_cells.cellOf(cell, cellMin[0], cellMin[1]);
+			cellMax[0] = cellMin[0];
+			cellMax[1] = cellMin[1];
+			if (_overlaps(min, max, cellMin, cellMax))
+				_collectCell(cell, results);
+		}
+		return;
+	}
+
+	for (int r = min[0]; r <= max[0]; r++)
+	{
+		for (int c = min[1]; c <= max[1]; c++)
+		{
+			_collect(r, c, results);
+		}
+	}
+}
+
+void SpatialHashGrid::_collectLarge(const int* min, const int* max, std::vector<int>& results)
+{
+	for (int id : m_large)
+	{
+		const Client& cli = m_clients[id];
+		if (m_stamps[id] == m_query || !_overlaps(min, max, cli.min, cli.max)) continue;
+		m_stamps[id] = m_query;
+		results.push_back(id);
+	}
+}
+
+bool SpatialHashGrid::_overlaps(const int* aMin, const int* aMax, const int* bMin, const int* bMax)
+{
+	return aMin[0] <= bMax[0] && bMin[0] <= aMax[0] && aMin[1] <= bMax[1] && bMin[1] <= aMax[1];
+}
+
+void SpatialHashGrid::setCellSize(float size)
+{
+	// Positions are divided by the size on every lookup
+	if (!std::isfinite(size) || size <= 0.f)
+		return;
+
+	m_cellDims = Vec2f(size, size);
+	m_rows = std::max(1, static_cast<int>(std::lround((m_extents.x - m_origin.x) / size)));
+	m_cols = std::max(1, static_cast<int>(std::lround((m_extents.y - m_origin.y) / size)));
+
+	// Every client changes cells, start over from stored positions
+	m_cells.clear();
+	m_large.clear();
+	m_cellStart.clear();
+	m_sorted.clear();
+	for (Client& cli : m_clients)
+	{
+		if (cli.id == -1) continue;
+		_getBounds(cli.position, cli.radius, cli.min, cli.max);
+		_place(cli.id);
+	}
+	m_dirty = true;
+}
+
+bool SpatialHashGrid::_isFirstSharedCell(int i, int j, int r, int c) const
+{
+	const Client& a = m_clients[i];
+	const Client& b = m_clients[j];
+	return r == std::max(a.min[0], b.min[0]) && c == std::max(a.min[1], b.min[1]);
+}
+
+void SpatialHashGrid::reserve(int idCount)
+{
+	if (idCount > static_cast<int>(m_clients.size()))
+	{
+		m_clients.resize(idCount);
+		m_stamps.resize(idCount, 0);
+	}
+}
+
+void SpatialHashGrid::setMode(GridMode mode)
+{
+	if (mode == m_mode)
+		return;
+
+	m_mode = mode;
+	m_cells.clear();
+	if (m_mode == GridMode::REBUILD)
+	{
+		m_dirty = true;
+		return;
+	}
+
+	m_cellStart.clear();
+	m_sorted.clear();
+	for (const Client& cli : m_clients)
+	{
+		if (cli.id != -1 && !cli.large)
+			_insert(cli.id);
+	}
+}
+
+void SpatialHashGrid::rebuild()
+{
+	if (m_mode != GridMode::REBUILD || !m_dirty)
+		return;
+	m_dirty = false;
+
+	// Cells are recreated from scratch so cells nobody occupies anymore vanish
+	m_cells.clear();
+
+	// Pass 1: cell of every (client, cell) entry. Clients are walked in id
+	// order so ids inside a cell come out sorted and deterministic
+	m_entryCells.clear();
+	for (const Client& cli : m_clients)
+	{
+		if (cli.id == -1 || cli.large) continue;
+		for (int r = cli.min[0]; r <= cli.max[0]; r++)
 		{
-			std::string cell = _key(r, c);
-			for (int id : m_cells[cell])
+			for (int c = cli.min[1]; c <= cli.max[1]; c++)
 			{
-				results.insert(id);
+				m_entryCells.push_back(m_cells.index(r, c));
 			}
 		}
 	}
-	return results;
-}
\ No newline at end of file
+
+	// Histogram then exclusive prefix sum, m_cellStart[i] is first slot of cell i
+	m_cellStart.assign(m_cells.size() + 1, 0);
+	for (int cell : m_entryCells)
+		m_cellStart[cell + 1]++;
+	for (size_t i = 1; i < m_cellStart.size(); i++)
+		m_cellStart[i] += m_cellStart[i - 1];
+
+	// Pass 2: scatter ids using starts as write cursors, which leaves every
+	// start pointing at the next cell so shift them back afterwards
+	m_sorted.resize(m_entryCells.size());
+	size_t e = 0;
+	for (const Client& cli : m_clients)
+	{
+		if (cli.id == -1 || cli.large) continue;
+		for (int r = cli.min[0]; r <= cli.max[0]; r++)
+		{
+			for (int c = cli.min[1]; c <= cli.max[1]; c++)
+			{
+				m_sorted[m_cellStart[m_entryCells[e++]]++] = cli.id;
+			}
+		}
+	}
+	for (size_t i = m_cellStart.size() - 1; i > 0; i--)
+		m_cellStart[i] = m_cellStart[i - 1];
+	m_cellStart[0] = 0;
+}
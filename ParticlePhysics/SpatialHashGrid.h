@@ -5,17 +5,19 @@
 */
 #ifndef SPATIALHASHGRID_H
 #define SPATIALHASHGRID_H
-#include <list>
-#include <map>
-#include <set>
-#include <string>
+#include <vector>
+#include <utility>
 #include "Vec2f.h"
+#include "CellTable.h"
 
 struct Client
 {
 	int id;
 	int min[2]{};
 	int max[2]{};
+	Vec2f position;
+	float radius = 0.f;
+	bool large = false;	// kept in the large object list instead of cells
 
 	Client() { id = -1; }
 	Client(int i) { id = i; }
@@ -27,7 +29,27 @@ struct Client
 	}
 };
 
-// TODO : make grid infinite where empty cells are disabled
+/*
+* How cell membership is maintained between frames.
+* INCREMENTAL moves a client between cell buckets whenever its cells change.
+* REBUILD only records client bounds on update and rebuilds every cell with a
+* counting sort into one contiguous id array before the next query.
+*/
+enum class GridMode
+{
+	INCREMENTAL,
+	REBUILD
+};
+
+#define GRID_CELL_LIMIT			1.0e9f	// Cell indices are clamped to +-limit
+#define GRID_LARGE_OBJECT_CELLS	16		// Clients covering more cells go to the large list
+
+/*
+* Unbounded hashed grid. Origin and extents only set the cell size, any
+* position maps to a cell and only occupied cells are stored.
+* Clients covering more than GRID_LARGE_OBJECT_CELLS cells are kept in a
+* separate large object list so no client is inserted into many cells.
+*/
 class SpatialHashGrid
 {
 private:
@@ -37,14 +59,22 @@ private:
 	int m_rows;
 	int m_cols;
 
-	std::map<std::string, std::set<int>> m_cells{};
-	std::map<int, Client> m_clients;
-	std::set<int> m_potentialCollisions{};
+	GridMode m_mode = GridMode::INCREMENTAL;
+	CellTable m_cells{};
+	std::vector<Client> m_clients;
+	std::vector<int> m_large;
+	std::vector<int> m_scratch;
 
-	std::string _key(int r, int c)
-	{
-		return std::to_string(r) + '.' + std::to_string(c);
-	}
+	// Counting sort storage for REBUILD mode, cell i owns
+	// m_sorted[m_cellStart[i]] to m_sorted[m_cellStart[i + 1] - 1]
+	std::vector<int> m_cellStart;
+	std::vector<int> m_sorted;
+	std::vector<int> m_entryCells;
+	bool m_dirty = false;
+
+	// Query stamps per id so findNear can dedupe without a set
+	std::vector<unsigned int> m_stamps;
+	unsigned int m_query = 0;
 
 public:
 	SpatialHashGrid() { m_rows = -1; m_cols = -1; }
@@ -66,8 +96,9 @@ public:
 
 	/*
 	* Update client's position in grid
+	* @return true if the client moved to a different range of cells
 	*/
-	void update(int id, const Vec2f& position, float radius);
+	bool update(int id, const Vec2f& position, float radius);
 	
 	/*
 	* Remove client from grid
@@ -80,13 +111,59 @@ public:
 	void deleteClient(int id);
 
 	/*
-	* Find all clients in cells in radius near position
+	* Find all clients in cells in radius near position. Each id is
+	* appended to results once, results is not cleared.
 	*/
-	std::set<int> findNear(const Vec2f& position, float radius, std::set<int>& results);
+	void findNear(const Vec2f& position, float radius, std::vector<int>& results);
+	/*
+	* Find all clients sharing a cell with client i. Each id is appended
+	* to results once, results is not cleared.
+	*/
+	void findNear(int i, std::vector<int>& results);
+
 	/*
-	* Find all clients in cells in radius near position
+	* Append every pair of clients sharing at least one cell exactly once
+	* as (smaller id, larger id). A pair is only emitted from the first
+	* cell of the overlap of both cell ranges so no dedupe is needed.
 	*/
-	std::set<int> findNear(int i, std::set<int>& results);
+	void findPairs(std::vector<std::pair<int, int>>& pairs);
+
+	/*
+	* Use square cells of size and rebin every client from its last
+	* position. Rows and cols are updated to cover origin to extents.
+	* Sizes that are not finite and positive are ignored.
+	*/
+	void setCellSize(float size);
+	const Vec2f& getCellDims() const	{ return m_cellDims; }
+
+	/*
+	* Number of clients in the large object list
+	*/
+	int getLargeCount() const			{ return static_cast<int>(m_large.size()); }
+
+	/*
+	* Switch how cells are maintained, existing clients are carried over
+	*/
+	void setMode(GridMode mode);
+	GridMode getMode() const			{ return m_mode; }
+
+	/*
+	* Make room for clients with ids below idCount so bulk adds do not
+	* regrow the client array
+	*/
+	void reserve(int idCount);
+
+	/*
+	* Rebuild all cells from client bounds with a two pass counting sort.
+	* Only does work in REBUILD mode when a client changed since last rebuild.
+	*/
+	void rebuild();
+
+	/*
+	* Client ids grouped by cell, clients spanning several cells appear once
+	* per cell. Only valid in REBUILD mode after rebuild.
+	*/
+	const std::vector<int>& getSortedIds() const	{ return m_sorted; }
 
 	const Vec2f& getOrigin() const		{ return m_origin; }
 	const Vec2f& getExtents() const		{ return m_extents; }
@@ -95,10 +172,74 @@ public:
 
 private:
 	/*
-	* Find cells { min, max } and clamp to bounds of grid
+	* Row and col index of the cell containing position, floored so
+	* negative coordinates work
 	* @return row and col index of position
 	*/
 	void _getCellIndex(const Vec2f& position, int* b) const;
+
+	/*
+	* Cell range covered by a circle
+	*/
+	void _getBounds(const Vec2f& position, float radius, int* min, int* max) const;
+
+	/*
+	* True if a client with these bounds belongs in the large object list
+	*/
+	bool _isLarge(const int* min, const int* max) const;
+
+	/*
+	* Put client i into cells or the large list from its current bounds
+	*/
+	void _place(int i);
+
+	/*
+	* Take client i out of its cells or the large list
+	*/
+	void _unplace(int i);
+
+	/*
+	* Make sure client and stamp arrays can be indexed by id
+	*/
+	void _reserveClient(int id);
+
+	/*
+	* Insert client i into the buckets of every cell it covers
+	*/
+	void _insert(int i);
+
+	/*
+	* Start a new findNear query so previous stamps are ignored
+	*/
+	void _beginQuery();
+
+	/*
+	* Append ids of cell r, c not yet seen by current query
+	*/
+	void _collect(int r, int c, std::vector<int>& results);
+
+	/*
+	* Append ids of the cell with dense index cell not yet seen
+	*/
+	void _collectCell(int cell, std::vector<int>& results);
+
+	/*
+	* Append ids of every cell in min to max not yet seen, walks the
+	* occupied cells instead when the range is larger
+	*/
+	void _collectRange(const int* min, const int* max, std::vector<int>& results);
+
+	/*
+	* Append large clients overlapping min to max not yet seen
+	*/
+	void _collectLarge(const int* min, const int* max, std::vector<int>& results);
+
+	static bool _overlaps(const int* aMin, const int* aMax, const int* bMin, const int* bMax);
+
+	/*
+	* True if r, c is the top left cell shared by clients i and j
+	*/
+	bool _isFirstSharedCell(int i, int j, int r, int c) const;
 };
 
 #endif // !SPATIALHASHGRID_H
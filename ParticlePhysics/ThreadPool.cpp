@@ -0,0 +1,80 @@
+/*
+* Fixed size pool of worker threads for data parallel loops
+* @author Dominick Dimpfel
+* @date 02/10/2024
+*/
+
+#include "ThreadPool.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+ThreadPool::ThreadPool(int threads)
+{
+	for (int t = 1; t < threads; t++)
+		m_workers.emplace_back(&ThreadPool::_work, this, t);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void ThreadPool::_run(const void* task, void (*call)(const void* task, int thread))
+{
+	if (m_workers.empty())
+	{
+		call(task, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task = task;
+		m_call = call;
+		m_pending = static_cast<int>(m_workers.size());
+		m_generation++;
+	}
+	m_wake.notify_all();
+
+	call(task, 0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_pending == 0; });
+	m_task = nullptr;
+	m_call = nullptr;
+}
+
+void ThreadPool::_work(int thread)
+{
+	unsigned int seen = 0;
+	while (true)
+	{
+		const void* task;
+		void (*call)(const void*, int);
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+			if (m_stop)
+				return;
+			seen = m_generation;
+			task = m_task;
+			call = m_call;
+		}
+
+		call(task, thread);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_pending == 0)
+				m_done.notify_one();
+		}
+	}
+}
@@ -0,0 +1,75 @@
+/*
+* Fixed size pool of worker threads for data parallel loops
+* @author Dominick Dimpfel
+* @date 02/10/2024
+*/
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class ThreadPool
+{
+private:
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+
+	// Task of the current run and the function calling it, tasks are
+	// borrowed so running one never allocates
+	const void* m_task = nullptr;
+	void (*m_call)(const void* task, int thread) = nullptr;
+	unsigned int m_generation = 0;
+	int m_pending = 0;
+	bool m_stop = false;
+
+public:
+	/*
+	* Pool running tasks on threads threads, the calling thread counts
+	* as thread 0 so threads - 1 workers are started
+	*/
+	explicit ThreadPool(int threads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator = (const ThreadPool&) = delete;
+
+	/*
+	* Run task(t) once for every thread t in [0, size()) and wait for all
+	*/
+	template <typename Task>
+	void run(const Task& task)
+	{
+		_run(&task, [](const void* fn, int thread) { (*static_cast<const Task*>(fn))(thread); });
+	}
+
+	/*
+	* Split [begin, end) into size() contiguous chunks, one per thread,
+	* and call fn(thread, first, last) for each non empty one.
+	* Chunks only depend on the range and thread count.
+	*/
+	template <typename Fn>
+	void parallelFor(int begin, int end, const Fn& fn)
+	{
+		int threads = size();
+		int count = end - begin;
+		run([&](int t)
+		{
+			int first = begin + static_cast<int>(static_cast<long long>(count) * t / threads);
+			int last = begin + static_cast<int>(static_cast<long long>(count) * (t + 1) / threads);
+			if (first < last)
+				fn(t, first, last);
+		});
+	}
+
+	int size() const		{ return static_cast<int>(m_workers.size()) + 1; }
+
+private:
+	void _run(const void* task, void (*call)(const void* task, int thread));
+	void _work(int thread);
+};
+
+#endif // !THREADPOOL_H
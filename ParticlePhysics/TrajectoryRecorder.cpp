@@ -0,0 +1,404 @@
+/*
+* Trajectory recorder with a background I/O thread and its reader
+* @author Dominick Dimpfel
+* @date 03/01/2024
+*/
+
+#include "TrajectoryRecorder.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ParticleStore.h"
+
+// IEEE half precision, rounded to nearest even. Out of range values
+// become infinity and tiny ones subnormals or zero.
+static std::uint16_t floatToHalf(float value)
+{
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	std::uint32_t sign = (bits >> 16) & 0x8000u;
+	std::uint32_t mantissa = bits & 0x7fffffu;
+	int exponent = static_cast<int>((bits >> 23) & 0xffu);
+
+	if (exponent == 0xff)
+		return static_cast<std::uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+	exponent += 15 - 127;
+	if (exponent >= 31)
+		return static_cast<std::uint16_t>(sign | 0x7c00u);
+
+	std::uint32_t half;
+	std::uint32_t shift;
+	if (exponent <= 0)
+	{
+		if (exponent < -10)
+			return static_cast<std::uint16_t>(sign);
+		mantissa |= 0x800000u;
+		shift = static_cast<std::uint32_t>(14 - exponent);
+		half = mantissa >> shift;
+	}
+	else
+	{
+		shift = 13;
+		half = (static_cast<std::uint32_t>(exponent) << 10) | (mantissa >> shift);
+	}
+
+	// A carry out of the mantissa correctly bumps the exponent
+	std::uint32_t rest = mantissa & ((1u << shift) - 1);
+	std::uint32_t halfway = 1u << (shift - 1);
+	if (rest > halfway || (rest == halfway && (half & 1u)))
+		half++;
+	return static_cast<std::uint16_t>(sign | half);
+}
+
+static float halfToFloat(std::uint16_t half)
+{
+	std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000u) << 16;
+	std::uint32_t exponent = (half >> 10) & 0x1fu;
+	std::uint32_t mantissa = half & 0x3ffu;
+
+	if (exponent == 0)
+	{
+		float value = std::ldexp(static_cast<float>(mantissa), -24);
+		return sign ? -value : value;
+	}
+
+	std::uint32_t bits = exponent == 31
+		? sign | 0x7f800000u | (mantissa << 13)
+		: sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static void putVarint(std::vector<unsigned char>& bytes, std::int64_t value)
+{
+	// Zigzag so small negative deltas stay short
+	std::uint64_t v = (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+	while (v >= 0x80u)
+	{
+		bytes.push_back(static_cast<unsigned char>(v | 0x80u));
+		v >>= 7;
+	}
+	bytes.push_back(static_cast<unsigned char>(v));
+}
+
+static bool getVarint(const unsigned char*& at, const unsigned char* end, std::int64_t& value)
+{
+	std::uint64_t v = 0;
+	for (int shift = 0; at < end && shift < 64; shift += 7)
+	{
+		unsigned char byte = *at++;
+		v |= static_cast<std::uint64_t>(byte & 0x7fu) << shift;
+		if (!(byte & 0x80u))
+		{
+			value = static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1u);
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename T>
+static void putRaw(std::vector<unsigned char>& bytes, const T* data, int count)
+{
+	size_t offset = bytes.size();
+	bytes.resize(offset + sizeof(T) * count);
+	std::memcpy(bytes.data() + offset, data, sizeof(T) * count);
+}
+
+template <typename T>
+static bool getRaw(const unsigned char*& at, const unsigned char* end, T* data, int count)
+{
+	size_t size = sizeof(T) * count;
+	if (static_cast<size_t>(end - at) < size)
+		return false;
+	std::memcpy(data, at, size);
+	at += size;
+	return true;
+}
+
+/*
+* Previous quantised values of the ids in a frame, unseen ids start at 0
+*/
+static void growPrevious(std::vector<std::int64_t>* previous, const std::vector<int>& ids)
+{
+	int top = 0;
+	for (int id : ids)
+		top = std::max(top, id + 1);
+	for (int c = 0; c < 4; c++)
+		if (static_cast<int>(previous[c].size()) < top)
+			previous[c].resize(top, 0);
+}
+
+bool TrajectoryRecorder::open(const std::string& path, TrajectoryEncoding encoding, int interval,
+	float positionQuantum, float velocityQuantum)
+{
+	close();
+	m_out.open(path, std::ios::binary | std::ios::trunc);
+	if (!m_out)
+		return false;
+
+	std::memcpy(m_header.magic, TRAJECTORY_MAGIC, sizeof(m_header.magic));
+	m_header.version = TRAJECTORY_VERSION;
+	m_header.encoding = static_cast<std::uint32_t>(encoding);
+	m_header.interval = interval > 0 ? interval : 1;
+	m_header.frameCount = 0;
+	m_header.positionQuantum = positionQuantum;
+	m_header.velocityQuantum = velocityQuantum;
+	m_out.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+	m_interval = m_header.interval;
+
+	for (int c = 0; c < 4; c++)
+		m_previous[c].clear();
+	m_front = 0;
+	m_ready = false;
+	m_busy = false;
+	m_stop = false;
+	m_framesWritten = 0;
+	m_framesDropped = 0;
+	m_bytesWritten = sizeof(m_header);
+	m_failed = !m_out;
+	m_thread = std::thread(&TrajectoryRecorder::_run, this);
+	return !m_failed;
+}
+
+void TrajectoryRecorder::record(int step, const ParticleStore& ps)
+{
+	if (!isOpen() || step % m_interval != 0)
+		return;
+
+	{
+		// The I/O thread only ever writes the buffer handed over last, the
+		// front one is free unless that handoff is still waiting
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_ready)
+		{
+			m_framesDropped++;
+			return;
+		}
+	}
+
+	// The front buffer is only touched by this thread
+	TrajectoryFrame& frame = m_frames[m_front];
+	frame.step = step;
+	frame.id.assign(ps.id.begin(), ps.id.end());
+	frame.x.assign(ps.x.begin(), ps.x.end());
+	frame.y.assign(ps.y.begin(), ps.y.end());
+	frame.vx.assign(ps.vx.begin(), ps.vx.end());
+	frame.vy.assign(ps.vy.begin(), ps.vy.end());
+	frame.mass.assign(ps.mass.begin(), ps.mass.end());
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_front ^= 1;
+		m_ready = true;
+	}
+	m_wake.notify_one();
+}
+
+bool TrajectoryRecorder::close()
+{
+	if (!isOpen())
+		return !m_failed;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_one();
+	m_thread.join();
+
+	m_header.frameCount = m_framesWritten;
+	m_out.seekp(0);
+	m_out.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
+	m_out.close();
+	if (m_out.fail())
+		m_failed = true;
+	return !m_failed;
+}
+
+const char* TrajectoryRecorder::encodingName(TrajectoryEncoding encoding)
+{
+	switch (encoding)
+	{
+	case TrajectoryEncoding::FLOAT16:	return "f16";
+	case TrajectoryEncoding::DELTA:		return "delta";
+	default:							return "f32";
+	}
+}
+
+bool TrajectoryRecorder::parseEncoding(const std::string& name, TrajectoryEncoding& encoding)
+{
+	if (name == "f32")
+		encoding = TrajectoryEncoding::FLOAT32;
+	else if (name == "f16")
+		encoding = TrajectoryEncoding::FLOAT16;
+	else if (name == "delta")
+		encoding = TrajectoryEncoding::DELTA;
+	else
+		return false;
+	return true;
+}
+
+void TrajectoryRecorder::_run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;)
+	{
+		m_wake.wait(lock, [this] { return m_ready || m_stop; });
+		// A frame handed over before close is still written
+		if (!m_ready)
+			break;
+
+		m_ready = false;
+		m_busy = true;
+		const TrajectoryFrame& frame = m_frames[m_front ^ 1];
+		lock.unlock();
+		_write(frame);
+		lock.lock();
+		m_busy = false;
+	}
+}
+
+void TrajectoryRecorder::_write(const TrajectoryFrame& frame)
+{
+	int count = static_cast<int>(frame.id.size());
+	bool keyframe = m_framesWritten % TRAJECTORY_KEYFRAME_INTERVAL == 0;
+	const std::vector<float>* columns[4] = { &frame.x, &frame.y, &frame.vx, &frame.vy };
+
+	m_bytes.clear();
+	putRaw(m_bytes, frame.id.data(), count);
+	switch (static_cast<TrajectoryEncoding>(m_header.encoding))
+	{
+	case TrajectoryEncoding::FLOAT32:
+		for (int c = 0; c < 4; c++)
+			putRaw(m_bytes, columns[c]->data(), count);
+		break;
+	case TrajectoryEncoding::FLOAT16:
+		for (int c = 0; c < 4; c++)
+		{
+			size_t offset = m_bytes.size();
+			m_bytes.resize(offset + sizeof(std::uint16_t) * count);
+			unsigned char* out = m_bytes.data() + offset;
+			for (int i = 0; i < count; i++)
+			{
+				std::uint16_t half = floatToHalf((*columns[c])[i]);
+				std::memcpy(out + sizeof(half) * i, &half, sizeof(half));
+			}
+		}
+		break;
+	case TrajectoryEncoding::DELTA:
+		growPrevious(m_previous, frame.id);
+		for (int c = 0; c < 4; c++)
+		{
+			double quantum = c < 2 ? m_header.positionQuantum : m_header.velocityQuantum;
+			std::vector<std::int64_t>& previous = m_previous[c];
+			for (int i = 0; i < count; i++)
+			{
+				std::int64_t q = std::llround((*columns[c])[i] / quantum);
+				std::int64_t& last = previous[frame.id[i]];
+				putVarint(m_bytes, keyframe ? q : q - last);
+				last = q;
+			}
+		}
+		break;
+	}
+	putRaw(m_bytes, frame.mass.data(), count);
+
+	TrajectoryFrameHeader header = {};
+	header.step = frame.step;
+	header.count = count;
+	header.keyframe = keyframe ? 1 : 0;
+	header.bytes = m_bytes.size();
+	m_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	m_out.write(reinterpret_cast<const char*>(m_bytes.data()), static_cast<std::streamsize>(m_bytes.size()));
+	if (!m_out)
+		m_failed = true;
+	m_framesWritten++;
+	m_bytesWritten += static_cast<long long>(sizeof(header) + m_bytes.size());
+}
+
+bool TrajectoryReader::open(const std::string& path)
+{
+	m_in.open(path, std::ios::binary);
+	if (!m_in.read(reinterpret_cast<char*>(&m_header), sizeof(m_header)))
+		return false;
+	for (int c = 0; c < 4; c++)
+		m_previous[c].clear();
+	return std::memcmp(m_header.magic, TRAJECTORY_MAGIC, sizeof(m_header.magic)) == 0 &&
+		m_header.version == TRAJECTORY_VERSION &&
+		m_header.encoding <= static_cast<std::uint32_t>(TrajectoryEncoding::DELTA);
+}
+
+bool TrajectoryReader::next(TrajectoryFrame& frame)
+{
+	TrajectoryFrameHeader header;
+	if (!m_in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.count < 0)
+		return false;
+	m_bytes.resize(header.bytes);
+	if (!m_in.read(reinterpret_cast<char*>(m_bytes.data()), static_cast<std::streamsize>(header.bytes)))
+		return false;
+
+	int count = header.count;
+	frame.step = header.step;
+	frame.id.resize(count);
+	frame.x.resize(count);
+	frame.y.resize(count);
+	frame.vx.resize(count);
+	frame.vy.resize(count);
+	frame.mass.resize(count);
+	std::vector<float>* columns[4] = { &frame.x, &frame.y, &frame.vx, &frame.vy };
+
+	const unsigned char* at = m_bytes.data();
+	const unsigned char* end = at + m_bytes.size();
+	if (!getRaw(at, end, frame.id.data(), count))
+		return false;
+	for (int id : frame.id)
+		if (id < 0)
+			return false;
+
+	switch (static_cast<TrajectoryEncoding>(m_header.encoding))
+	{
+	case TrajectoryEncoding::FLOAT32:
+		for (int c = 0; c < 4; c++)
+			if (!getRaw(at, end, columns[c]->data(), count))
+				return false;
+		break;
+	case TrajectoryEncoding::FLOAT16:
+		for (int c = 0; c < 4; c++)
+		{
+			if (static_cast<size_t>(end - at) < sizeof(std::uint16_t) * count)
+				return false;
+			for (int i = 0; i < count; i++, at += sizeof(std::uint16_t))
+			{
+				std::uint16_t half;
+				std::memcpy(&half, at, sizeof(half));
+				(*columns[c])[i] = halfToFloat(half);
+			}
+		}
+		break;
+	case TrajectoryEncoding::DELTA:
+		growPrevious(m_previous, frame.id);
+		for (int c = 0; c < 4; c++)
+		{
+			double quantum = c < 2 ? m_header.positionQuantum : m_header.velocityQuantum;
+			std::vector<std::int64_t>& previous = m_previous[c];
+			for (int i = 0; i < count; i++)
+			{
+				std::int64_t delta;
+				if (!getVarint(at, end, delta))
+					return false;
+				std::int64_t& last = previous[frame.id[i]];
+				last = header.keyframe ? delta : last + delta;
+				(*columns[c])[i] = static_cast<float>(last * quantum);
+			}
+		}
+		break;
+	}
+	return getRaw(at, end, frame.mass.data(), count);
+}
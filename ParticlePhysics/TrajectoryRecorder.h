@@ -0,0 +1,174 @@
+/*
+* Streams particle trajectories to a columnar binary file. Every interval
+* steps the ids, positions, velocities and masses are copied into a frame
+* buffer and handed to an I/O thread that encodes and writes them, so the
+* simulation thread never waits on the disk. There are two frame buffers,
+* a frame is filled into one while the I/O thread writes the other. Only
+* when the previous frame has not been picked up yet is the new one
+* dropped and counted instead of blocking.
+* File layout: a TrajectoryFileHeader, then per frame a TrajectoryFrameHeader
+* followed by the id column and the x, y, vx, vy and mass columns. Ids are
+* int32 and mass is float32 in every encoding, the other columns are
+* float32, float16 or quantised deltas against the same id in the previous
+* frame, zigzag varint coded. Delta frames restart from zero every
+* TRAJECTORY_KEYFRAME_INTERVAL frames so a reader can start there.
+* Ids of merged particles are reused, an id that leaves a frame and comes
+* back later belongs to a new particle.
+* Float16 keeps about three digits and loses precision below 6e-5, which
+* covers most velocities, DELTA is exact to half a quantum instead.
+* @author Dominick Dimpfel
+* @date 03/01/2024
+*/
+#ifndef TRAJECTORYRECORDER_H
+#define TRAJECTORYRECORDER_H
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ParticleStore.h"
+
+#define TRAJECTORY_MAGIC				"PPTRAJ\r\n"
+#define TRAJECTORY_VERSION				1
+#define TRAJECTORY_KEYFRAME_INTERVAL	64
+#define TRAJECTORY_POSITION_QUANTUM		1e-3f // Default delta position step
+#define TRAJECTORY_VELOCITY_QUANTUM		1e-6f // Default delta velocity step
+
+enum class TrajectoryEncoding
+{
+	FLOAT32,
+	FLOAT16,
+	DELTA
+};
+
+struct TrajectoryFileHeader
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t encoding;			// TrajectoryEncoding
+	std::int32_t interval;			// steps between frames
+	std::int32_t frameCount;		// patched on close
+	float positionQuantum;
+	float velocityQuantum;
+};
+
+struct TrajectoryFrameHeader
+{
+	std::int32_t step;
+	std::int32_t count;				// particles in the frame
+	std::int32_t keyframe;			// deltas are against zero
+	std::int32_t reserved;
+	std::uint64_t bytes;			// column data following this header
+};
+
+/*
+* One decoded or captured frame, columns are indexed alike
+*/
+struct TrajectoryFrame
+{
+	int step = 0;
+	std::vector<int> id;
+	std::vector<float> x, y;
+	std::vector<float> vx, vy;
+	std::vector<float> mass;
+};
+
+class TrajectoryRecorder
+{
+private:
+	std::ofstream m_out;
+	TrajectoryFileHeader m_header;
+	int m_interval = 1;
+
+	// m_frames[m_front] is filled by record, the other one belongs to the
+	// I/O thread while m_ready or m_busy is set. While m_ready is set the
+	// front one may still be written, so record drops the frame.
+	TrajectoryFrame m_frames[2];
+	int m_front = 0;
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_ready = false;
+	bool m_busy = false;
+	bool m_stop = false;
+
+	// Written by the I/O thread only
+	std::vector<unsigned char> m_bytes;
+	std::vector<std::int64_t> m_previous[4];	// last quantised x, y, vx, vy by id
+	std::atomic<int> m_framesWritten{ 0 };
+	std::atomic<long long> m_bytesWritten{ 0 };
+	std::atomic<bool> m_failed{ false };
+
+	int m_framesDropped = 0;
+
+public:
+	TrajectoryRecorder() = default;
+	~TrajectoryRecorder()				{ close(); }
+	TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+	TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+	/*
+	* Start writing path and the I/O thread. Frames are taken on steps
+	* that are a multiple of interval, quanta only apply to DELTA.
+	*/
+	bool open(const std::string& path, TrajectoryEncoding encoding, int interval,
+		float positionQuantum = TRAJECTORY_POSITION_QUANTUM, float velocityQuantum = TRAJECTORY_VELOCITY_QUANTUM);
+
+	/*
+	* Copy the store as the frame of step if step is on the interval.
+	* Only copies, encoding and writing happen on the I/O thread.
+	*/
+	void record(int step, const ParticleStore& ps);
+
+	/*
+	* Write the pending frame, stop the I/O thread and finish the file
+	* @return false if any write failed
+	*/
+	bool close();
+
+	bool isOpen() const					{ return m_thread.joinable(); }
+	int getFramesWritten() const		{ return m_framesWritten; }
+	int getFramesDropped() const		{ return m_framesDropped; }
+	long long getBytesWritten() const	{ return m_bytesWritten; }
+
+	static const char* encodingName(TrajectoryEncoding encoding);
+	static bool parseEncoding(const std::string& name, TrajectoryEncoding& encoding);
+
+private:
+	void _run();
+
+	/*
+	* Encode frame into m_bytes and write it
+	*/
+	void _write(const TrajectoryFrame& frame);
+};
+
+/*
+* Sequential reader for files written by TrajectoryRecorder
+*/
+class TrajectoryReader
+{
+private:
+	std::ifstream m_in;
+	TrajectoryFileHeader m_header;
+	std::vector<unsigned char> m_bytes;
+	std::vector<std::int64_t> m_previous[4];
+
+public:
+	TrajectoryReader() = default;
+	~TrajectoryReader() = default;
+
+	bool open(const std::string& path);
+	const TrajectoryFileHeader& header() const	{ return m_header; }
+
+	/*
+	* Decode the next frame
+	* @return false at the end of the file or on a malformed frame
+	*/
+	bool next(TrajectoryFrame& frame);
+};
+
+#endif // !TRAJECTORYRECORDER_H
@@ -0,0 +1,79 @@
+/*
+* Lock free triple buffer handing whole values from one producer thread
+* to one consumer thread. The producer writes back() and publishes it,
+* the consumer takes the latest published value with acquire() and reads
+* front(). Each side owns one buffer and they swap with the third through
+* a single atomic index, so neither side ever waits on the other. Values
+* the consumer did not take before the next publish are overwritten.
+* @author Dominick Dimpfel
+* @date 03/04/2024
+*/
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+#include <atomic>
+
+#define TRIPLE_BUFFER_INDEX	3 // Buffer index bits of the shared slot
+#define TRIPLE_BUFFER_FRESH	4 // Shared slot holds a value not yet acquired
+
+template <typename T>
+class TripleBuffer
+{
+private:
+	T m_buffers[3];
+	int m_back = 0;						// producer only
+	int m_front = 1;					// consumer only
+	std::atomic<int> m_shared{ 2 };		// index | TRIPLE_BUFFER_FRESH
+
+	// Producer side counters
+	long long m_published = 0;
+	long long m_overwritten = 0;
+
+public:
+	TripleBuffer() = default;
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	/*
+	* Producer's buffer, its previous contents are stale
+	*/
+	T& back()							{ return m_buffers[m_back]; }
+
+	/*
+	* Make back() the latest value and take a new back buffer
+	* @return false if the previous value was never acquired
+	*/
+	bool publish()
+	{
+		int previous = m_shared.exchange(m_back | TRIPLE_BUFFER_FRESH, std::memory_order_acq_rel);
+		m_back = previous & TRIPLE_BUFFER_INDEX;
+		m_published++;
+		if (previous & TRIPLE_BUFFER_FRESH)
+		{
+			m_overwritten++;
+			return false;
+		}
+		return true;
+	}
+
+	/*
+	* Move the latest published value to front() if there is a new one
+	* @return true if front() changed
+	*/
+	bool acquire()
+	{
+		if (!(m_shared.load(std::memory_order_relaxed) & TRIPLE_BUFFER_FRESH))
+			return false;
+		m_front = m_shared.exchange(m_front, std::memory_order_acq_rel) & TRIPLE_BUFFER_INDEX;
+		return true;
+	}
+
+	/*
+	* Consumer's buffer, stays unchanged until the next acquire()
+	*/
+	const T& front() const				{ return m_buffers[m_front]; }
+
+	long long getPublished() const		{ return m_published; }
+	long long getOverwritten() const	{ return m_overwritten; }
+};
+
+#endif // !TRIPLEBUFFER_H
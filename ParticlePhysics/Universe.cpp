@@ -6,176 +6,925 @@
 
 #include "Universe.h"
 #include <vector>
-#include <map>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <cstring>
+#include <type_traits>
 #include "Vec2f.h"
 #include "Particle.h"
+#include "ParticleStore.h"
 #include "Manifold.h"
 #include "SpatialHashGrid.h"
+#include "BarnesHut.h"
+#include "ThreadPool.h"
+#include "GravityKernel.h"
+#include "FastMultipole.h"
+#include "ParticleMesh.h"
+#include "DisjointSet.h"
+#include "Snapshot.h"
+#include "Instrumentation.h"
 
-Universe::Universe()
+Universe::Universe() :
+	m_barnesHut(BARNES_HUT_THETA, G_CONSTANT, EPSILON_ACCURACY),
+	m_multipole(FMM_ORDER, FMM_THETA, G_CONSTANT, EPSILON_ACCURACY),
+	m_particleMesh(PM_MESH_SIZE, G_CONSTANT),
+	m_gravityKernel(G_CONSTANT, EPSILON_ACCURACY)
 {
 	m_collisionGrid = SpatialHashGrid(Vec2f(0, 0), Vec2f(1200, 680), 25, 15);
-	//gravityGrid = Grid(21, 14, Vec2f(80, 80), Vec2f(-240, -180));
+	m_gravityGrid = SpatialHashGrid(Vec2f(0, 0), Vec2f(1200, 680), 25, 15);
+	m_gravityGrid.setMode(GridMode::REBUILD);
 	m_size = UNIVERSE_CAPACITY;
-	m_manifold = Manifold();
+	m_pool = std::make_unique<ThreadPool>(1);
 }
 Universe::~Universe(){}
 
-// Need to fix id list so this can work. Also some how accessing deleted particle which is causing major data corruption
 void Universe::update(float deltaTime)
 {
-	for (auto& particle : m_particles)
+	ParticleStore& ps = m_particles;
+	m_instrumentation.beginStep();
+	StepStats& stats = m_instrumentation.current();
+
+	m_merged.assign(ps.size(), 0);
+	{
+		PARTICLES_TIME_SCOPE(stats.time.broadPhase);
+		// Retune before the first query too, the default cell size can put
+		// a dense scene's particles in a handful of cells
+		if (m_gridAutoTune && m_stepCount % GRID_RETUNE_INTERVAL == 0)
+		{
+			retuneCollisionGrid();
+			m_collisionGrid.rebuild();
+		}
+		// No-op unless clients changed outside update, e.g. a snapshot load
+		m_collisionGrid.rebuild();
+		m_candidatePairs.clear();
+		m_collisionGrid.findPairs(m_candidatePairs);
+	}
+	PARTICLES_COUNT(stats.candidatePairs, static_cast<long long>(m_candidatePairs.size()));
+
+	{
+		PARTICLES_TIME_SCOPE(stats.time.narrowPhase);
+		findContacts();
+		PARTICLES_COUNT(stats.contacts, static_cast<long long>(m_mergePairs.size() + m_contactPairs.size()));
+
+		PARTICLES_TIME_SCOPE(stats.time.response);
+		// Merges first so contacts see the merged particles
+		resolveCoalescence();
+		colorContacts();
+		solveContacts();
+		removeMergedParticles();
+	}
+
+	integrate(deltaTime);
+
+	{
+		PARTICLES_TIME_SCOPE(stats.time.broadPhase);
+		for (int i = 0; i < ps.size(); i++)
+		{
+			bool moved = m_collisionGrid.update(ps.id[i], Vec2f(ps.x[i], ps.y[i]), ps.radius[i]);
+			PARTICLES_COUNT(stats.cellMigrations, moved ? 1 : 0);
+		}
+		m_collisionGrid.rebuild();
+	}
+
+	m_stepCount++;
+	m_instrumentation.endStep();
+}
+
+void Universe::integrate(float deltaTime)
+{
+	switch (m_integrator)
+	{
+	case Integrator::LEAPFROG:
+		drift(deltaTime * 0.5f);
+		evaluateGravity();
+		kick(deltaTime);
+		drift(deltaTime * 0.5f);
+		break;
+	case Integrator::YOSHIDA4:
+	{
+		// Three leapfrog steps of w1, w0, w1 with the inner drifts merged
+		const double cbrt2 = std::cbrt(2.0);
+		const float w1 = static_cast<float>(1.0 / (2.0 - cbrt2));
+		const float w0 = static_cast<float>(-cbrt2 / (2.0 - cbrt2));
+		const float drifts[4] = { w1 * 0.5f, (w0 + w1) * 0.5f, (w0 + w1) * 0.5f, w1 * 0.5f };
+		const float kicks[3] = { w1, w0, w1 };
+		for (int stage = 0; stage < 3; stage++)
+		{
+			drift(deltaTime * drifts[stage]);
+			evaluateGravity();
+			kick(deltaTime * kicks[stage]);
+		}
+		drift(deltaTime * drifts[3]);
+		break;
+	}
+	case Integrator::BLOCK_LEAPFROG:
+		integrateBlocks(deltaTime);
+		break;
+	default:
+		evaluateGravity();
+		kick(deltaTime);
+		drift(deltaTime);
+		break;
+	}
+}
+
+void Universe::integrateBlocks(float deltaTime)
+{
+	ParticleStore& ps = m_particles;
+	int n = ps.size();
+
+	// Accelerations at the start of the step, normally left by the closing
+	// kicks of the previous step
+	if (!m_blockForcesValid)
+	{
+		evaluateGravity();
+		kick(0.f);
+	}
+
+	m_blockLevels.resize(n);
+	int top = 0;
+	for (int i = 0; i < n; i++)
+	{
+		float a = std::sqrt(ps.ax[i] * ps.ax[i] + ps.ay[i] * ps.ay[i]);
+		float v = std::sqrt(ps.vx[i] * ps.vx[i] + ps.vy[i] * ps.vy[i]);
+		float step = a > 0.f ? BLOCK_ETA * std::max(v / a, std::sqrt(ps.radius[i] / a)) : deltaTime;
+
+		int level = 0;
+		while (level < BLOCK_MAX_LEVEL && step < deltaTime / static_cast<float>(1 << level))
+			level++;
+		m_blockLevels[i] = level;
+		top = std::max(top, level);
+	}
+
+	// Opening half kick of every particle's first block step
+	for (int i = 0; i < n; i++)
 	{
-		Particle& a = particle.second;
+		float half = deltaTime / static_cast<float>(1 << m_blockLevels[i]) * 0.5f;
+		ps.vx[i] += ps.ax[i] * half;
+		ps.vy[i] += ps.ay[i] * half;
+	}
+
+	// Level k is due every 2^(top - k) sub-steps, its closing kick and the
+	// opening kick of its next block step are merged except at the end
+	int substeps = 1 << top;
+	float h = deltaTime / static_cast<float>(substeps);
+	for (int s = 1; s <= substeps; s++)
+	{
+		drift(h);
 
-		m_collisionGrid.findNear(a.getID(), m_potentialCollisionsIds);
+		m_blockActive.clear();
+		for (int i = 0; i < n; i++)
+		{
+			if (s % (1 << (top - m_blockLevels[i])) == 0)
+				m_blockActive.push_back(i);
+		}
+		evaluateGravity(m_blockActive);
 
-		for (int id : m_potentialCollisionsIds)
+		PARTICLES_TIME_SCOPE(m_instrumentation.current().time.integration);
+		for (int i : m_blockActive)
 		{
-			if (a.getID() == id) continue;
-			Particle& b = m_particles[id];
+			float step = deltaTime / static_cast<float>(1 << m_blockLevels[i]);
+			if (s == substeps)
+				step *= 0.5f;
+			ps.ax[i] = ps.fx[i] * ps.invMass[i];
+			ps.ay[i] = ps.fy[i] * ps.invMass[i];
+			ps.vx[i] += ps.ax[i] * step;
+			ps.vy[i] += ps.ay[i] * step;
+			ps.fx[i] = 0.f;
+			ps.fy[i] = 0.f;
+		}
+	}
+	m_blockForcesValid = true;
+}
+
+void Universe::evaluateGravity()
+{
+	PARTICLES_TIME_SCOPE(m_instrumentation.current().time.gravity);
+	PARTICLES_COUNT(m_instrumentation.current().gravityTargets, m_particles.size());
+	applySolverGravity();
+}
 
-			m_manifold.reset();
-			if (particlesColliding(a, b, m_manifold))
+void Universe::evaluateGravity(const std::vector<int>& targets)
+{
+	ParticleStore& ps = m_particles;
+	if (static_cast<int>(targets.size()) == ps.size())
+	{
+		evaluateGravity();
+		return;
+	}
+
+	PARTICLES_TIME_SCOPE(m_instrumentation.current().time.gravity);
+	PARTICLES_COUNT(m_instrumentation.current().gravityTargets, static_cast<long long>(targets.size()));
+	int count = static_cast<int>(targets.size());
+	switch (m_gravitySolver)
+	{
+	case GravitySolver::DIRECT:
+		m_pool->parallelFor(0, count, [&](int, int first, int last)
+		{
+			for (int t = first; t < last; t++)
 			{
-				if (m_manifold.isCoalescing())
-				{
-					//std::cout << id << " b id" << std::endl;
-					applyCoalescence(a, b);
-					std::cout << std::endl;
-					break;
-				}
-				applyImpulse(a, b, m_manifold);
+				int i = targets[t];
+				m_gravityKernel.target(i, ps.size(), ps.x.data(), ps.y.data(), ps.mass.data(), ps.fx[i], ps.fy[i]);
 			}
+		});
+		break;
+	case GravitySolver::BARNES_HUT:
+		m_barnesHut.build(ps.x.data(), ps.y.data(), ps.mass.data(), ps.size());
+		m_pool->parallelFor(0, count, [&](int, int first, int last)
+		{
+			for (int t = first; t < last; t++)
+			{
+				int i = targets[t];
+				m_barnesHut.computeForce(i, ps.fx[i], ps.fy[i]);
+			}
+		});
+		break;
+	default:
+	{
+		// Whole field solvers, keep only the targets' forces
+		applySolverGravity();
+		m_blockScratch.assign(ps.size(), 0);
+		for (int i : targets)
+			m_blockScratch[i] = 1;
+		for (int i = 0; i < ps.size(); i++)
+		{
+			if (m_blockScratch[i]) continue;
+			ps.fx[i] = 0.f;
+			ps.fy[i] = 0.f;
 		}
+		break;
+	}
+	}
+}
+
+void Universe::kick(float step)
+{
+	PARTICLES_TIME_SCOPE(m_instrumentation.current().time.integration);
+	ParticleStore& ps = m_particles;
+	int n = ps.size();
+	float* vx = ps.vx.data();
+	float* vy = ps.vy.data();
+	float* ax = ps.ax.data();
+	float* ay = ps.ay.data();
+	float* fx = ps.fx.data();
+	float* fy = ps.fy.data();
+	const float* invMass = ps.invMass.data();
+	for (int i = 0; i < n; i++)
+	{
+		ax[i] = fx[i] * invMass[i];
+		ay[i] = fy[i] * invMass[i];
+		vx[i] += ax[i] * step;
+		vy[i] += ay[i] * step;
+		fx[i] = 0.f;
+		fy[i] = 0.f;
+	}
+}
 
-		m_potentialCollisionsIds.clear();
+void Universe::drift(float step)
+{
+	PARTICLES_TIME_SCOPE(m_instrumentation.current().time.integration);
+	ParticleStore& ps = m_particles;
+	int n = ps.size();
+	float* x = ps.x.data();
+	float* y = ps.y.data();
+	const float* vx = ps.vx.data();
+	const float* vy = ps.vy.data();
+	for (int i = 0; i < n; i++)
+	{
+		x[i] += vx[i] * step;
+		y[i] += vy[i] * step;
 	}
+}
+
+void Universe::findContacts()
+{
+	ParticleStore& ps = m_particles;
+	int threads = m_pool->size();
+	int count = static_cast<int>(m_candidatePairs.size());
+	m_threadMerges.resize(threads);
+	m_threadContacts.resize(threads);
 
-	for (auto itA = m_particles.begin(); itA != m_particles.end(); ++itA)
+	// Only reads the store, every thread takes a contiguous run of the
+	// candidates so the concatenation below keeps the candidate order
+	m_pool->run([&](int t)
 	{
-		auto itB = itA;
-		itB++;
-		for (; itB != m_particles.end(); ++itB)
+		std::vector<std::pair<int, int>>& merges = m_threadMerges[t];
+		std::vector<std::pair<int, int>>& contacts = m_threadContacts[t];
+		merges.clear();
+		contacts.clear();
+
+		int chunk = (count + threads - 1) / threads;
+		int first = std::min(t * chunk, count);
+		int last = std::min(first + chunk, count);
+		Manifold manifold;
+		for (int i = first; i < last; i++)
 		{
-			applyGravity(itA->second, itB->second);
+			int a = ps.slotOf(m_candidatePairs[i].first);
+			int b = ps.slotOf(m_candidatePairs[i].second);
+			manifold.reset();
+			if (particlesColliding(a, b, manifold))
+			{
+				if (manifold.isCoalescing())
+					merges.emplace_back(a, b);
+				else
+					contacts.emplace_back(a, b);
+			}
 		}
-	}
+	});
 
-	for (auto& kv : m_particles)
+	m_mergePairs.clear();
+	m_contactPairs.clear();
+	for (int t = 0; t < threads; t++)
 	{
-		Particle& particle = kv.second;
-		particle.update(deltaTime);
-		m_collisionGrid.update(particle.getID(), particle.getPos(), particle.getRadius());
+		m_mergePairs.insert(m_mergePairs.end(), m_threadMerges[t].begin(), m_threadMerges[t].end());
+		m_contactPairs.insert(m_contactPairs.end(), m_threadContacts[t].begin(), m_threadContacts[t].end());
 	}
 }
 
 // TODO: Make new particle as container of old particles to add destruction?
-void Universe::applyCoalescence(Particle& a, Particle& b)
+void Universe::resolveCoalescence()
 {
-	// B is larger mass but A cannot be deleted (itA++ throws exceptions otherwise)
-	if (b.getMass() > a.getMass())
+	if (m_mergePairs.empty())
+		return;
+
+	ParticleStore& ps = m_particles;
+	m_mergeSets.reset(ps.size());
+	for (const std::pair<int, int>& pair : m_mergePairs)
+		m_mergeSets.unite(pair.first, pair.second);
+
+	// Members grouped by root, roots are the smallest slot of a group so
+	// the sorted order does not depend on the pair order
+	m_mergeMembers.clear();
+	for (const std::pair<int, int>& pair : m_mergePairs)
+	{
+		m_mergeMembers.emplace_back(m_mergeSets.find(pair.first), pair.first);
+		m_mergeMembers.emplace_back(m_mergeSets.find(pair.second), pair.second);
+	}
+	std::sort(m_mergeMembers.begin(), m_mergeMembers.end());
+	m_mergeMembers.erase(std::unique(m_mergeMembers.begin(), m_mergeMembers.end()), m_mergeMembers.end());
+
+	int count = static_cast<int>(m_mergeMembers.size());
+	for (int first = 0, last = 0; first < count; first = last)
 	{
-		//std::cout << "b was larger" << std::endl;
-		Vec2f pr = a.getPos() - b.getPos();
-		Vec2f pOffset = pr * b.getInvMass();
-		a.setPos(b.getPos() + pOffset);
+		int root = m_mergeMembers[first].first;
+		last = first;
+		while (last < count && m_mergeMembers[last].first == root)
+			last++;
 
-		Vec2f vr = a.getVel() - b.getVel();
-		Vec2f vOffset = vr * b.getInvMass();
-		a.setVel(b.getVel() + vOffset);
+		// Heaviest member survives and keeps its id, lowest id on ties
+		int survivor = m_mergeMembers[first].second;
+		double mass = 0.0, x = 0.0, y = 0.0, vx = 0.0, vy = 0.0, ax = 0.0, ay = 0.0, area = 0.0;
+		float fx = 0.f, fy = 0.f;
+		for (int i = first; i < last; i++)
+		{
+			int s = m_mergeMembers[i].second;
+			if (ps.mass[s] > ps.mass[survivor] || (ps.mass[s] == ps.mass[survivor] && ps.id[s] < ps.id[survivor]))
+				survivor = s;
 
-		a.setRadius(std::sqrt(a.getRadius() * a.getRadius() + b.getRadius() * b.getRadius()));
-		a.setMass(a.getMass() + b.getMass());
-		a.addForce(b.getForces());
-		a.setColor(b.getColor());
+			mass += ps.mass[s];
+			x += static_cast<double>(ps.mass[s]) * ps.x[s];
+			y += static_cast<double>(ps.mass[s]) * ps.y[s];
+			vx += static_cast<double>(ps.mass[s]) * ps.vx[s];
+			vy += static_cast<double>(ps.mass[s]) * ps.vy[s];
+			ax += static_cast<double>(ps.mass[s]) * ps.ax[s];
+			ay += static_cast<double>(ps.mass[s]) * ps.ay[s];
+			area += static_cast<double>(ps.radius[s]) * ps.radius[s];
+			fx += ps.fx[s];
+			fy += ps.fy[s];
+		}
 
-		int idb = b.getID();
-		m_collisionGrid.deleteClient(idb);
-		m_particles.erase(idb);
-		m_size--;
-		//std::cout << idb << " deleted by " << a.getID() << std::endl;
+		// Center of mass, momentum and area are kept, the acceleration
+		// block steps carry over is the mass weighted one
+		double invMass = mass > 0.0 ? 1.0 / mass : 0.0;
+		ps.x[survivor] = static_cast<float>(x * invMass);
+		ps.y[survivor] = static_cast<float>(y * invMass);
+		ps.vx[survivor] = static_cast<float>(vx * invMass);
+		ps.vy[survivor] = static_cast<float>(vy * invMass);
+		ps.radius[survivor] = static_cast<float>(std::sqrt(area));
+		ps.setMass(survivor, static_cast<float>(mass));
+		ps.fx[survivor] = fx;
+		ps.fy[survivor] = fy;
+		ps.ax[survivor] = static_cast<float>(ax * invMass);
+		ps.ay[survivor] = static_cast<float>(ay * invMass);
 
-		return;
+		// The rest leave the grid now but the store only after the
+		// contacts, their slots stay valid until then
+		for (int i = first; i < last; i++)
+		{
+			int s = m_mergeMembers[i].second;
+			if (s == survivor) continue;
+
+			int id = ps.id[s];
+			m_collisionGrid.deleteClient(id);
+			m_merged[s] = 1;
+			m_removedIds.push_back(id);
+			m_size--;
+			// Survivors' accelerations still hold the merged pull
+			m_blockForcesValid = false;
+			PARTICLES_COUNT(m_instrumentation.current().coalescences, 1);
+		}
 	}
-	//std::cout << "a was larger" << std::endl;
+}
+
+void Universe::colorContacts()
+{
+	ParticleStore& ps = m_particles;
+	m_contactColors.assign(ps.size(), 0);
+	m_pairColors.clear();
 
-	Vec2f pr = b.getPos() - a.getPos();
-	Vec2f pOffset = pr * a.getInvMass();
-	a.setPos(a.getPos() + pOffset);
+	// Pairs of a merged particle are compacted away, the rest take the
+	// first color free on both particles
+	int kept = 0;
+	for (const std::pair<int, int>& pair : m_contactPairs)
+	{
+		int a = pair.first;
+		int b = pair.second;
+		if (m_merged[a] || m_merged[b]) continue;
 
-	Vec2f vr = b.getVel() - a.getVel();
-	Vec2f vOffset = vr * a.getInvMass();
-	a.setVel(a.getVel() + vOffset);
+		std::uint64_t taken = m_contactColors[a] | m_contactColors[b];
+		int color = 0;
+		while (color < CONTACT_MAX_COLORS && (taken & (std::uint64_t(1) << color)))
+			color++;
+		if (color < CONTACT_MAX_COLORS)
+		{
+			m_contactColors[a] |= std::uint64_t(1) << color;
+			m_contactColors[b] |= std::uint64_t(1) << color;
+		}
+		m_contactPairs[kept++] = pair;
+		m_pairColors.push_back(color);
+	}
+	m_contactPairs.resize(kept);
 
-	a.setRadius(std::sqrt(a.getRadius() * a.getRadius() + b.getRadius() * b.getRadius()));
-	a.setMass(a.getMass() + b.getMass());
-	a.addForce(b.getForces());
+	// Counting sort by color, stable so every batch keeps candidate order
+	int batches = CONTACT_MAX_COLORS + 1;
+	m_contactBatches.assign(batches + 1, 0);
+	for (int color : m_pairColors)
+		m_contactBatches[color + 1]++;
+	for (int c = 0; c < batches; c++)
+	{
+		PARTICLES_COUNT(m_instrumentation.current().contactBatches, m_contactBatches[c + 1] > 0 ? 1 : 0);
+		m_contactBatches[c + 1] += m_contactBatches[c];
+	}
 
-	int idb = b.getID();
-	m_collisionGrid.deleteClient(idb);
-	m_particles.erase(idb);
-	m_size--;
-	//std::cout << idb << " deleted by " << a.getID() << std::endl;
+	m_coloredContacts.resize(kept);
+	m_batchCursors.assign(m_contactBatches.begin(), m_contactBatches.end() - 1);
+	for (int i = 0; i < kept; i++)
+		m_coloredContacts[m_batchCursors[m_pairColors[i]]++] = m_contactPairs[i];
 }
 
-void Universe::applyImpulse(Particle& a, Particle& b, const Manifold& m)
+void Universe::solveContacts()
 {
+	int batches = static_cast<int>(m_contactBatches.size()) - 1;
+	auto solve = [&](int first, int last)
+	{
+		Manifold manifold;
+		for (int i = first; i < last; i++)
+		{
+			int a = m_coloredContacts[i].first;
+			int b = m_coloredContacts[i].second;
+
+			// Earlier impulses moved the pair so the manifold is redone,
+			// a pair that would now coalesce waits for the next step
+			manifold.reset();
+			if (particlesColliding(a, b, manifold) && !manifold.isCoalescing())
+				applyImpulse(a, b, manifold);
+		}
+	};
+
+	for (int iteration = 0; iteration < m_contactIterations; iteration++)
+	{
+		for (int c = 0; c < batches; c++)
+		{
+			int first = m_contactBatches[c];
+			int last = m_contactBatches[c + 1];
+
+			// Pairs past the last color can share particles
+			if (c == CONTACT_MAX_COLORS || last - first < CONTACT_PARALLEL_MIN)
+			{
+				solve(first, last);
+				continue;
+			}
+			m_pool->parallelFor(first, last, [&](int, int from, int to)
+			{
+				solve(from, to);
+			});
+		}
+	}
+}
+
+void Universe::removeMergedParticles()
+{
+	for (int id : m_removedIds)
+		m_particles.remove(id);
+	m_removedIds.clear();
+}
+
+void Universe::retuneCollisionGrid()
+{
+	if (m_particles.empty())
+		return;
+
+	m_radiusScratch.assign(m_particles.radius.begin(), m_particles.radius.end());
+	auto k = m_radiusScratch.begin() + static_cast<long>(GRID_RADIUS_PERCENTILE * (m_radiusScratch.size() - 1));
+	std::nth_element(m_radiusScratch.begin(), k, m_radiusScratch.end());
+	float size = std::max(*k * GRID_CELL_TO_RADIUS, GRID_MIN_CELL_SIZE);
+
+	// Rebinning touches every client, skip small changes
+	float current = m_collisionGrid.getCellDims().x;
+	if (std::abs(size - current) <= current * GRID_RETUNE_TOLERANCE)
+		return;
+	m_collisionGrid.setCellSize(size);
+}
+
+void Universe::applyImpulse(int a, int b, const Manifold& m)
+{
+	ParticleStore& ps = m_particles;
+	Vec2f aPos(ps.x[a], ps.y[a]), bPos(ps.x[b], ps.y[b]);
+	Vec2f aVel(ps.vx[a], ps.vy[a]), bVel(ps.vx[b], ps.vy[b]);
+
 	Vec2f normal = m.getNormal();
 	// Normal should point from a to b
-	if (normal.dot(b.getPos() - a.getPos()) < 0.f)
+	if (normal.dot(bPos - aPos) < 0.f)
 		normal.negate();
 
-	Vec2f relativeVelocity = a.getVel() - b.getVel();
+	Vec2f relativeVelocity = aVel - bVel;
 	float relNormalVelMag = relativeVelocity.dot(normal);
 
-	// Linear impulse
+	// Linear impulse, only while approaching. A pair already separating
+	// would be pulled back together, which later solver passes hit since
+	// the first one leaves most contacts separating.
 	float res = RESTITUTION + 1;
-	float j = (-relNormalVelMag * res) / (a.getInvMass() + b.getInvMass());
+	float j = relNormalVelMag > 0.f ? (-relNormalVelMag * res) / (ps.invMass[a] + ps.invMass[b]) : 0.f;
 
 	Vec2f jn = normal * j;
-	Vec2f av = a.getVel() + (jn * a.getInvMass());
-	Vec2f bv = b.getVel() - (jn * b.getInvMass());
+	Vec2f av = aVel + (jn * ps.invMass[a]);
+	Vec2f bv = bVel - (jn * ps.invMass[b]);
 
 	Vec2f correction = (normal * CORRECTION_SLOP) * m.getDepth() / 2;
-	a.setPos(a.getPos() - correction);
-	b.setPos(b.getPos() + correction);
+	aPos -= correction;
+	bPos += correction;
 
-	a.setVel(av);
-	b.setVel(bv);
+	ps.x[a] = aPos.x;
+	ps.y[a] = aPos.y;
+	ps.x[b] = bPos.x;
+	ps.y[b] = bPos.y;
+	ps.vx[a] = av.x;
+	ps.vy[a] = av.y;
+	ps.vx[b] = bv.x;
+	ps.vy[b] = bv.y;
 }
 
-void Universe::applyGravity(Particle& a, Particle& b)
+void Universe::applyGravity(int a, int b)
 {
-	Vec2f r = a.getPos() - b.getPos();
+	ParticleStore& ps = m_particles;
+	float rx = ps.x[a] - ps.x[b];
+	float ry = ps.y[a] - ps.y[b];
+	float d = rx * rx + ry * ry;
 
 	// Ignore overlapping particles to avoid infinite force
-	if (r.magnitudeSquared() < EPSILON_ACCURACY)
+	if (d < EPSILON_ACCURACY)
 		return;
 
-	Vec2f rNormal = r.normalized();
+	// Normalized r scaled by G * ma * mb / d
+	float n = G_CONSTANT * ps.mass[a] * ps.mass[b];
+	float f = n / (d * std::sqrt(d));
 
-	float n = G_CONSTANT * a.getMass() * b.getMass();
-	float d = r.magnitudeSquared();
+	ps.fx[b] += rx * f;
+	ps.fy[b] += ry * f;
+	ps.fx[a] -= rx * f;
+	ps.fy[a] -= ry * f;
+}
 
+void Universe::setThreadCount(int threads)
+{
+	if (threads < 1)
+		threads = 1;
+	if (threads == m_pool->size())
+		return;
+	m_pool = std::make_unique<ThreadPool>(threads);
+}
 
-	Vec2f fg = rNormal * (n / d);
+void Universe::applyDirectGravity()
+{
+	if (m_pool->size() > 1)
+	{
+		applyParallelGravity();
+		return;
+	}
 
-	b.addForce(fg);
-	a.addForce(-fg);
+	ParticleStore& ps = m_particles;
+	for (int a = 0; a < ps.size(); a++)
+		applyGravityRow(a, ps.fx.data(), ps.fy.data());
 }
 
-bool Universe::particlesColliding(Particle& a, Particle& b, Manifold& m)
+void Universe::applyParallelGravity()
 {
-	float radii = a.getRadius() + b.getRadius();
-	Vec2f distance = a.getPos() - b.getPos();
+	ParticleStore& ps = m_particles;
+	int n = ps.size();
+	int threads = m_pool->size();
+	m_threadFx.resize(threads);
+	m_threadFy.resize(threads);
+
+	// Later rows are shorter, dealing blocks round robin keeps work even
+	m_pool->run([&](int t)
+	{
+		std::vector<float>& fx = m_threadFx[t];
+		std::vector<float>& fy = m_threadFy[t];
+		fx.assign(n, 0.f);
+		fy.assign(n, 0.f);
+
+		for (int block = t * GRAVITY_ROW_BLOCK; block < n; block += threads * GRAVITY_ROW_BLOCK)
+		{
+			int last = std::min(block + GRAVITY_ROW_BLOCK, n);
+			for (int a = block; a < last; a++)
+				applyGravityRow(a, fx.data(), fy.data());
+		}
+	});
+
+	m_pool->parallelFor(0, n, [&](int, int first, int last)
+	{
+		for (int t = 0; t < threads; t++)
+		{
+			const float* fx = m_threadFx[t].data();
+			const float* fy = m_threadFy[t].data();
+			for (int i = first; i < last; i++)
+			{
+				ps.fx[i] += fx[i];
+				ps.fy[i] += fy[i];
+			}
+		}
+	});
+}
+
+void Universe::applyGravityRow(int a, float* fx, float* fy) const
+{
+	const ParticleStore& ps = m_particles;
+	m_gravityKernel.row(a, ps.size(), ps.x.data(), ps.y.data(), ps.mass.data(), fx, fy);
+}
+
+void Universe::applyBarnesHutGravity()
+{
+	ParticleStore& ps = m_particles;
+	m_barnesHut.build(ps.x.data(), ps.y.data(), ps.mass.data(), ps.size());
+
+	// Every particle walks the tree on its own, no shared writes
+	m_pool->parallelFor(0, ps.size(), [&](int, int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			float fx = 0.f, fy = 0.f;
+			m_barnesHut.computeForce(i, fx, fy);
+			ps.fx[i] += fx;
+			ps.fy[i] += fy;
+		}
+	});
+}
+
+void Universe::applyMultipoleGravity()
+{
+	ParticleStore& ps = m_particles;
+	m_multipole.build(ps.x.data(), ps.y.data(), ps.mass.data(), ps.size());
+	m_multipole.computeForces(*m_pool, ps.fx.data(), ps.fy.data());
+}
+
+void Universe::applyParticleMeshGravity()
+{
+	ParticleStore& ps = m_particles;
+	bool shortRange = m_gravitySolver == GravitySolver::P3M;
+	m_particleMesh.setSplitRadius(shortRange ? m_gravityCutoff / PM_CUTOFF_SPLITS : 0.f);
+	m_particleMesh.computeForces(*m_pool, ps.x.data(), ps.y.data(), ps.mass.data(), ps.size(),
+		ps.fx.data(), ps.fy.data());
+	if (shortRange)
+		applyShortRangeGravity();
+}
+
+void Universe::applyCutoffGravity()
+{
+	findGravityPairs(m_gravityCutoff);
+	applyPairGravity(m_gravityCutoff, 0.f);
+}
+
+void Universe::applyShortRangeGravity()
+{
+	float cutoff = m_particleMesh.getCutoff();
+	if (cutoff <= 0.f)
+		return;
+	findGravityPairs(cutoff);
+	applyPairGravity(cutoff, m_particleMesh.getSplitRadius());
+}
+
+void Universe::findGravityPairs(float cutoff)
+{
+	ParticleStore& ps = m_particles;
+
+	// Boxes of half the cutoff overlap for every pair within the cutoff,
+	// so findPairs with cutoff sized cells finds them all
+	if (m_gravityGrid.getCellDims().x != cutoff)
+		m_gravityGrid.setCellSize(cutoff);
+	for (int i = 0; i < ps.size(); i++)
+	{
+		Vec2f position(ps.x[i], ps.y[i]);
+		if (i < m_gravityGridCount)
+			m_gravityGrid.update(i, position, cutoff * 0.5f);
+		else
+			m_gravityGrid.addClient(i, position, cutoff * 0.5f);
+	}
+	for (int i = ps.size(); i < m_gravityGridCount; i++)
+		m_gravityGrid.deleteClient(i);
+	m_gravityGridCount = ps.size();
+	m_gravityGrid.rebuild();
+
+	m_gravityPairs.clear();
+	m_gravityGrid.findPairs(m_gravityPairs);
+}
+
+void Universe::applyPairGravity(float cutoff, float split)
+{
+	ParticleStore& ps = m_particles;
+	int n = ps.size();
+	int threads = m_pool->size();
+	m_threadFx.resize(threads);
+	m_threadFy.resize(threads);
+	float cutoffSq = cutoff * cutoff;
+	long long pairs = static_cast<long long>(m_gravityPairs.size());
+	m_pool->run([&](int t)
+	{
+		std::vector<float>& fx = m_threadFx[t];
+		std::vector<float>& fy = m_threadFy[t];
+		fx.assign(n, 0.f);
+		fy.assign(n, 0.f);
+
+		int first = static_cast<int>(pairs * t / threads);
+		int last = static_cast<int>(pairs * (t + 1) / threads);
+		for (int p = first; p < last; p++)
+		{
+			int a = m_gravityPairs[p].first;
+			int b = m_gravityPairs[p].second;
+			float rx = ps.x[a] - ps.x[b];
+			float ry = ps.y[a] - ps.y[b];
+			float d = rx * rx + ry * ry;
+			if (d < EPSILON_ACCURACY || d >= cutoffSq)
+				continue;
+
+			float r = std::sqrt(d);
+			float scale = split > 0.f ? ParticleMesh::shortRangeFactor(r, split) : gravitySwitch(r, cutoff);
+			float f = G_CONSTANT * ps.mass[a] * ps.mass[b] / (d * r) * scale;
+			fx[b] += rx * f;
+			fy[b] += ry * f;
+			fx[a] -= rx * f;
+			fy[a] -= ry * f;
+		}
+	});
+
+	m_pool->parallelFor(0, n, [&](int, int first, int last)
+	{
+		for (int t = 0; t < threads; t++)
+		{
+			const float* fx = m_threadFx[t].data();
+			const float* fy = m_threadFy[t].data();
+			for (int i = first; i < last; i++)
+			{
+				ps.fx[i] += fx[i];
+				ps.fy[i] += fy[i];
+			}
+		}
+	});
+}
+
+float Universe::gravitySwitch(float r, float cutoff)
+{
+	// Quintic smoothstep from 1 at GRAVITY_SWITCH_START * cutoff down to 0
+	// at the cutoff, force and its slope are continuous at both ends so
+	// pairs crossing the cutoff do not kick the energy
+	float start = GRAVITY_SWITCH_START * cutoff;
+	if (r <= start)
+		return 1.f;
+	if (r >= cutoff)
+		return 0.f;
+	float x = (r - start) / (cutoff - start);
+	return 1.f - x * x * x * (10.f - x * (15.f - 6.f * x));
+}
+
+void Universe::applySolverGravity()
+{
+	switch (m_gravitySolver)
+	{
+	case GravitySolver::BARNES_HUT:	applyBarnesHutGravity(); break;
+	case GravitySolver::FMM:		applyMultipoleGravity(); break;
+	case GravitySolver::PARTICLE_MESH:
+	case GravitySolver::P3M:		applyParticleMeshGravity(); break;
+	case GravitySolver::CUTOFF:		applyCutoffGravity(); break;
+	default:						applyDirectGravity(); break;
+	}
+}
+
+float Universe::checkGravityAccuracy()
+{
+	if (m_gravitySolver == GravitySolver::DIRECT)
+		return 0.f;
+
+	// Real forces are restored afterwards
+	ParticleStore& ps = m_particles;
+	std::vector<float> savedX = ps.fx, savedY = ps.fy;
+
+	std::fill(ps.fx.begin(), ps.fx.end(), 0.f);
+	std::fill(ps.fy.begin(), ps.fy.end(), 0.f);
+	applySolverGravity();
+	std::vector<float> approxX = ps.fx, approxY = ps.fy;
+
+	// Exact forces from applyGravity
+	std::fill(ps.fx.begin(), ps.fx.end(), 0.f);
+	std::fill(ps.fy.begin(), ps.fy.end(), 0.f);
+	for (int a = 0; a < ps.size(); a++)
+		for (int b = a + 1; b < ps.size(); b++)
+			applyGravity(a, b);
+
+	// Relative to the RMS force so particles whose net force nearly cancels
+	// out do not dominate the result
+	double errorSq = 0.0, forceSq = 0.0;
+	for (int i = 0; i < ps.size(); i++)
+	{
+		Vec2f f(ps.fx[i], ps.fy[i]);
+		errorSq += (Vec2f(approxX[i], approxY[i]) - f).magnitudeSquared();
+		forceSq += f.magnitudeSquared();
+	}
+
+	ps.fx.swap(savedX);
+	ps.fy.swap(savedY);
+	return forceSq > 0.0 ? static_cast<float>(std::sqrt(errorSq / forceSq)) : 0.f;
+}
+
+const char* Universe::gravitySolverName(GravitySolver solver)
+{
+	switch (solver)
+	{
+	case GravitySolver::BARNES_HUT:	return "barnes-hut";
+	case GravitySolver::FMM:		return "fmm";
+	case GravitySolver::PARTICLE_MESH:	return "pm";
+	case GravitySolver::P3M:		return "p3m";
+	case GravitySolver::CUTOFF:		return "cutoff";
+	default:						return "direct";
+	}
+}
+
+bool Universe::parseGravitySolver(const std::string& name, GravitySolver& solver)
+{
+	for (GravitySolver s : { GravitySolver::DIRECT, GravitySolver::BARNES_HUT, GravitySolver::FMM,
+		GravitySolver::PARTICLE_MESH, GravitySolver::P3M, GravitySolver::CUTOFF })
+	{
+		if (name == gravitySolverName(s))
+		{
+			solver = s;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* Universe::integratorName(Integrator integrator)
+{
+	switch (integrator)
+	{
+	case Integrator::LEAPFROG:	return "leapfrog";
+	case Integrator::YOSHIDA4:	return "yoshida4";
+	case Integrator::BLOCK_LEAPFROG:	return "block";
+	default:					return "euler";
+	}
+}
+
+bool Universe::parseIntegrator(const std::string& name, Integrator& integrator)
+{
+	for (Integrator i : { Integrator::SEMI_IMPLICIT_EULER, Integrator::LEAPFROG, Integrator::YOSHIDA4,
+		Integrator::BLOCK_LEAPFROG })
+	{
+		if (name == integratorName(i))
+		{
+			integrator = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Universe::particlesColliding(int a, int b, Manifold& m)
+{
+	ParticleStore& ps = m_particles;
+	Vec2f aPos(ps.x[a], ps.y[a]), bPos(ps.x[b], ps.y[b]);
+	Vec2f aVel(ps.vx[a], ps.vy[a]), bVel(ps.vx[b], ps.vy[b]);
+
+	float radii = ps.radius[a] + ps.radius[b];
+	Vec2f distance = aPos - bPos;
 
 	if (distance.magnitudeSquared() > radii * radii)
 		return false;
 
-	// Relative speed or distance between centers below threshold 
-	if (abs(a.getVel().dot(b.getVel()) - a.getVel().magnitudeSquared()) < COALESCE_TOLERANCE || 
-		a.getMass() > b.getMass() * MASS_COALESCE_RATIO ||
+	// Relative speed or distance between centers below threshold. Each pair
+	// is only tested once so both orders are checked
+	if (std::abs(aVel.dot(bVel) - aVel.magnitudeSquared()) < COALESCE_TOLERANCE || 
+		std::abs(bVel.dot(aVel) - bVel.magnitudeSquared()) < COALESCE_TOLERANCE ||
+		ps.mass[a] > ps.mass[b] * MASS_COALESCE_RATIO ||
+		ps.mass[b] > ps.mass[a] * MASS_COALESCE_RATIO ||
 		distance.magnitudeSquared() < EPSILON_ACCURACY)
 	{
 		m.setCoalescing(true);
@@ -183,38 +932,247 @@ bool Universe::particlesColliding(Particle& a, Particle& b, Manifold& m)
 	}
 
 	m.setNormal(distance.normalized());
-	m.setContactPoint(b.getPos() + distance / 2);
+	m.setContactPoint(bPos + distance / 2);
 	m.setDepth(radii - distance.magnitude());
 
 	return true;
 }
 
-Particle& Universe::createParticle(const Vec2f& startPos, const Vec2f& startVel)
+Particle Universe::createParticle(const Vec2f& startPos, const Vec2f& startVel)
 {
-	Particle p = Particle(m_idCount);
-	p.setPos(startPos);
-	p.setVel(startVel);
-	m_particles[m_idCount] = p;
+	int slot = m_particles.add();
+	int id = m_particles.id[slot];
+	m_blockForcesValid = false;
+	m_particles.x[slot] = startPos.x;
+	m_particles.y[slot] = startPos.y;
+	m_particles.vx[slot] = startVel.x;
+	m_particles.vy[slot] = startVel.y;
+
+	m_collisionGrid.addClient(id, startPos, m_particles.radius[slot]);
+
+	return Particle(&m_particles, id);
+}
+
+Particle Universe::createParticle(const Vec2f& startPos, const Vec2f& startVel, float mass, float radius)
+{
+	int slot = m_particles.add();
+	int id = m_particles.id[slot];
+	m_blockForcesValid = false;
+	m_particles.x[slot] = startPos.x;
+	m_particles.y[slot] = startPos.y;
+	m_particles.vx[slot] = startVel.x;
+	m_particles.vy[slot] = startVel.y;
+	m_particles.setMass(slot, mass);
+	m_particles.radius[slot] = radius;
+
+	m_collisionGrid.addClient(id, startPos, radius);
+
+	return Particle(&m_particles, id);
+}
 
-	m_collisionGrid.addClient(m_idCount, startPos, p.getRadius());
+int Universe::createParticles(const ParticleDesc* particles, int count)
+{
+	int first = addParticles(count);
+	for (int i = 0; i < count; i++)
+		setParticle(first + i, particles[i]);
+	addClients(first, count);
+	return first;
+}
 
-	return m_particles[m_idCount++];
+int Universe::addParticles(int count)
+{
+	m_blockForcesValid = false;
+	return m_particles.add(count);
 }
 
-Particle& Universe::createParticle(const Vec2f& startPos, const Vec2f& startVel, float mass, float radius)
+void Universe::setParticle(int slot, const ParticleDesc& desc)
 {
-	Particle p = Particle(m_idCount);
-	p.setPos(startPos);
-	p.setVel(startVel);
-	p.setMass(mass);
-	p.setRadius(radius);
-	m_particles[m_idCount] = p;
+	ParticleStore& ps = m_particles;
+	ps.x[slot] = desc.position.x;
+	ps.y[slot] = desc.position.y;
+	ps.vx[slot] = desc.velocity.x;
+	ps.vy[slot] = desc.velocity.y;
+	ps.setMass(slot, desc.mass);
+	ps.radius[slot] = desc.radius;
+	ps.color[slot] = desc.color;
+}
 
-	m_collisionGrid.addClient(m_idCount, startPos, radius);
+void Universe::addClients(int first, int count)
+{
+	const ParticleStore& ps = m_particles;
+	m_collisionGrid.reserve(ps.idCount());
+	for (int slot = first; slot < first + count; slot++)
+		m_collisionGrid.addClient(ps.id[slot], Vec2f(ps.x[slot], ps.y[slot]), ps.radius[slot]);
+}
 
-	return m_particles[m_idCount++];
+// Store arrays in snapshot file order, fn(field, array) for each
+template <typename Store, typename Fn>
+static void forEachStoreField(Store& ps, Fn fn)
+{
+	fn(SNAPSHOT_ID, ps.id);
+	fn(SNAPSHOT_X, ps.x);
+	fn(SNAPSHOT_Y, ps.y);
+	fn(SNAPSHOT_VX, ps.vx);
+	fn(SNAPSHOT_VY, ps.vy);
+	fn(SNAPSHOT_FX, ps.fx);
+	fn(SNAPSHOT_FY, ps.fy);
+	fn(SNAPSHOT_AX, ps.ax);
+	fn(SNAPSHOT_AY, ps.ay);
+	fn(SNAPSHOT_MASS, ps.mass);
+	fn(SNAPSHOT_INV_MASS, ps.invMass);
+	fn(SNAPSHOT_RADIUS, ps.radius);
+	fn(SNAPSHOT_COLOR, ps.color);
+	fn(SNAPSHOT_ACTIVE, ps.active);
 }
 
+bool Universe::saveSnapshot(const std::string& path, std::uint32_t fields) const
+{
+	SnapshotHeader header = {};
+	header.count = m_particles.size();
+	header.idCount = m_particles.idCount();
+	header.stepCount = m_stepCount;
+	header.gridOriginX = m_collisionGrid.getOrigin().x;
+	header.gridOriginY = m_collisionGrid.getOrigin().y;
+	header.gridExtentsX = m_collisionGrid.getExtents().x;
+	header.gridExtentsY = m_collisionGrid.getExtents().y;
+	header.gridCellX = m_collisionGrid.getCellDims().x;
+	header.gridCellY = m_collisionGrid.getCellDims().y;
+	header.gridRows = m_collisionGrid.getRows();
+	header.gridCols = m_collisionGrid.getCols();
+	header.gridMode = static_cast<std::int32_t>(m_collisionGrid.getMode());
+	header.gridAutoTune = m_gridAutoTune ? 1 : 0;
+	header.gravitySolver = static_cast<std::int32_t>(m_gravitySolver);
+	header.integrator = static_cast<std::int32_t>(m_integrator);
+	header.contactIterations = m_contactIterations;
+	header.gravityCutoff = m_gravityCutoff;
+	header.barnesHutTheta = getBarnesHutTheta();
+	header.multipoleOrder = getMultipoleOrder();
+	header.meshSize = getMeshSize();
+	header.blockForcesValid = m_blockForcesValid && (fields & SNAPSHOT_AX) && (fields & SNAPSHOT_AY) ? 1 : 0;
+
+	SnapshotWriter writer;
+	if (!writer.open(path, header))
+		return false;
+
+	bool written = true;
+	forEachStoreField(m_particles, [&](SnapshotField field, const auto& array)
+	{
+		if (written && ((fields & field) || field == SNAPSHOT_ID))
+			written = writer.addSection(field, array.data(), sizeof(array[0]), header.count);
+	});
+	return written && writer.finish();
+}
+
+bool Universe::loadSnapshot(const std::string& path)
+{
+	SnapshotReader reader;
+	if (!reader.open(path))
+		return false;
+
+	const SnapshotHeader& header = reader.header();
+	int count = static_cast<int>(header.count);
+	const int* ids = static_cast<const int*>(reader.section(SNAPSHOT_ID, sizeof(int)));
+	if (!ids || header.idCount < 0 || header.count > header.idCount)
+		return false;
+
+	// Settings are cast straight to their enums below
+	if (header.gravitySolver < 0 || header.gravitySolver > static_cast<std::int32_t>(GravitySolver::CUTOFF) ||
+		header.integrator < 0 || header.integrator > static_cast<std::int32_t>(Integrator::BLOCK_LEAPFROG) ||
+		header.gridMode < 0 || header.gridMode > static_cast<std::int32_t>(GridMode::REBUILD))
+		return false;
+
+	// Grid and solver settings divide by or loop over these, negated
+	// comparisons also reject NaN
+	if (header.gridRows <= 0 || header.gridCols <= 0 ||
+		!std::isfinite(header.gridCellX) || !(header.gridCellX > 0.f) ||
+		!std::isfinite(header.gridCellY) || !(header.gridCellY > 0.f) ||
+		!(header.gridExtentsX > header.gridOriginX) || !(header.gridExtentsY > header.gridOriginY) ||
+		header.contactIterations < 0 ||
+		header.multipoleOrder < 1 || header.multipoleOrder > FMM_MAX_ORDER ||
+		header.meshSize <= 0 ||
+		!std::isfinite(header.gravityCutoff) || !(header.gravityCutoff >= 0.f) ||
+		!std::isfinite(header.barnesHutTheta) || !(header.barnesHutTheta >= 0.f))
+		return false;
+
+	// Every claimed field must be readable before any array is replaced,
+	// a skipped one would leave the columns at different lengths
+	ParticleStore& ps = m_particles;
+	bool readable = true;
+	forEachStoreField(static_cast<const ParticleStore&>(ps), [&](SnapshotField field, const auto& array)
+	{
+		using Element = typename std::decay_t<decltype(array)>::value_type;
+		if ((header.fields & field) && !reader.section(field, sizeof(Element)))
+			readable = false;
+	});
+	if (!readable)
+		return false;
+
+	bool full = (header.fields & SNAPSHOT_ALL) == SNAPSHOT_ALL;
+	if (full)
+	{
+		// Ids must be in range and unique or the slot index and grid break
+		std::vector<unsigned char> seen(static_cast<std::size_t>(header.idCount), 0);
+		for (int i = 0; i < count; i++)
+		{
+			if (ids[i] < 0 || ids[i] >= header.idCount || seen[ids[i]])
+				return false;
+			seen[ids[i]] = 1;
+		}
+	}
+	else
+	{
+		// Partial snapshots only carry what changed since a full one
+		if (count != ps.size() || header.idCount != ps.idCount() ||
+			std::memcmp(ids, ps.id.data(), sizeof(int) * static_cast<std::size_t>(count)) != 0)
+			return false;
+	}
+
+	// Arrays are copied straight out of the mapping, a full snapshot holds
+	// every array so none is left at a stale size
+	forEachStoreField(ps, [&](SnapshotField field, auto& array)
+	{
+		using Element = typename std::decay_t<decltype(array)>::value_type;
+		const Element* data = static_cast<const Element*>(reader.section(field, sizeof(Element)));
+		if (data)
+			array.assign(data, data + count);
+	});
+
+	m_stepCount = header.stepCount;
+	if (full)
+	{
+		m_size = count;
+		ps.reindex(header.idCount);
+		m_gravitySolver = static_cast<GravitySolver>(header.gravitySolver);
+		m_integrator = static_cast<Integrator>(header.integrator);
+		m_contactIterations = header.contactIterations;
+		m_gravityCutoff = header.gravityCutoff;
+		setBarnesHutTheta(header.barnesHutTheta);
+		setMultipoleOrder(header.multipoleOrder);
+		setMeshSize(header.meshSize);
+		m_gridAutoTune = header.gridAutoTune != 0;
+	}
+	m_blockForcesValid = header.blockForcesValid != 0 && m_integrator == static_cast<Integrator>(header.integrator);
+
+	if (!full)
+	{
+		for (int i = 0; i < count; i++)
+			m_collisionGrid.update(ps.id[i], Vec2f(ps.x[i], ps.y[i]), ps.radius[i]);
+		return true;
+	}
+
+	// Grid is refilled from the restored particles with the saved cells,
+	// in REBUILD mode the cells are built by the next step's broad phase
+	Vec2f origin(header.gridOriginX, header.gridOriginY);
+	Vec2f extents(header.gridExtentsX, header.gridExtentsY);
+	m_collisionGrid = SpatialHashGrid(origin, extents, header.gridRows, header.gridCols);
+	if (m_collisionGrid.getCellDims().x != header.gridCellX || m_collisionGrid.getCellDims().y != header.gridCellY)
+		m_collisionGrid.setCellSize(header.gridCellX);
+	m_collisionGrid.setMode(static_cast<GridMode>(header.gridMode));
+	m_collisionGrid.reserve(header.idCount);
+	for (int i = 0; i < count; i++)
+		m_collisionGrid.addClient(ps.id[i], Vec2f(ps.x[i], ps.y[i]), ps.radius[i]);
+	return true;
+}
 
 Vec2f Universe::getTotalEnergy() const
 {
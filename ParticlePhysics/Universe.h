@@ -6,35 +6,162 @@
 #ifndef UNIVERSE_H
 #define UNIVERSE_H
 #include <vector>
-#include <map>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <string>
 #include "Vec2f.h"
 #include "Particle.h"
+#include "ParticleStore.h"
 #include "Manifold.h"
 #include "SpatialHashGrid.h"
+#include "BarnesHut.h"
+#include "ThreadPool.h"
+#include "GravityKernel.h"
+#include "FastMultipole.h"
+#include "ParticleMesh.h"
+#include "DisjointSet.h"
+#include "Snapshot.h"
+#include "Instrumentation.h"
 
 #define UNIVERSE_CAPACITY		2000
 #define GRID_ROWS				50
 #define GRID_COLS				50
 #define G_CONSTANT				0.000001f //6.67e-11f
-#define GRAV_EFFECT_DISTANCE	10.f
+#define GRAV_EFFECT_DISTANCE	10.f // Default cutoff of CUTOFF gravity and P3M
+#define GRAVITY_SWITCH_START	0.8f // Fraction of the cutoff where CUTOFF gravity starts to fade
 #define RESTITUTION				0.5f
 #define	MASS_COALESCE_RATIO		1000.f // Needed to handle tunnel issues
 #define COALESCE_TOLERANCE		0.0000001f
 #define EPSILON_ACCURACY		0.0000001f
 #define CORRECTION_SLOP			1.0001f
+#define BARNES_HUT_THETA		0.5f
+#define GRAVITY_ROW_BLOCK		16 // Rows handed to a thread at a time
+#define GRID_RETUNE_INTERVAL	30 // Steps between collision cell size checks
+#define GRID_RADIUS_PERCENTILE	0.9f
+#define GRID_CELL_TO_RADIUS		4.f // Cell size over the percentile radius
+#define GRID_RETUNE_TOLERANCE	0.25f // Relative change needed to rebin
+#define GRID_MIN_CELL_SIZE		1.f
+#define BLOCK_MAX_LEVEL			8 // Finest block step is deltaTime / 2^BLOCK_MAX_LEVEL
+#define BLOCK_ETA				0.1f // Block step over the particle's dynamical time
+#define CONTACT_ITERATIONS		1 // Default contact solver passes per step
+#define CONTACT_MAX_COLORS		64 // Contact batches, pairs past them are solved serially
+#define CONTACT_PARALLEL_MIN	256 // Smaller batches are solved on the calling thread
+
+/*
+* Gravity solvers available to Universe::update.
+* DIRECT sums every pair exactly, BARNES_HUT approximates distant groups
+* through a quadtree rebuilt each step, FMM translates multipole
+* expansions between tree cells in O(n). PARTICLE_MESH solves on a
+* uniform mesh with FFTs, which suits near uniform scenes that only need
+* long range gravity, and P3M adds exact short range forces between
+* neighbours found through the gravity grid. CUTOFF drops gravity beyond
+* the gravity cutoff entirely and only sums neighbours, O(n k) for scenes
+* where clustering is local.
+*/
+enum class GravitySolver
+{
+	DIRECT,
+	BARNES_HUT,
+	FMM,
+	PARTICLE_MESH,
+	P3M,
+	CUTOFF
+};
+
+/*
+* Time integrators for the gravity phase, all work on the store arrays.
+* SEMI_IMPLICIT_EULER is first order, LEAPFROG is the second order
+* drift-kick-drift form of velocity Verlet and YOSHIDA4 composes three
+* leapfrog steps into a fourth order one. Both symplectic schemes keep
+* orbits from decaying at step sizes where Euler spirals, YOSHIDA4 costs
+* three gravity evaluations per step. LEAPFROG is the default since it
+* costs one evaluation like Euler. BLOCK_LEAPFROG gives every particle its
+* own power of two fraction of the step and only evaluates gravity for
+* particles whose step ends, so a few fast particles do not force small
+* steps on everyone.
+*/
+enum class Integrator
+{
+	SEMI_IMPLICIT_EULER,
+	LEAPFROG,
+	YOSHIDA4,
+	BLOCK_LEAPFROG
+};
+
+/*
+* Initial state of one particle for Universe::createParticles
+*/
+struct ParticleDesc
+{
+	Vec2f position;
+	Vec2f velocity;
+	float mass = PARTICLE_MASS;
+	float radius = RADIUS_TO_MASS_RATIO * PARTICLE_MASS;
+	ParticleColor color;
+};
 
 class Universe
 {
 private:
 	SpatialHashGrid m_collisionGrid;
 	SpatialHashGrid m_gravityGrid;
-	std::set<int> m_potentialCollisionsIds;
-	std::set<int> m_gravityEffectors;
+	// Store slots are the gravity grid ids, refilled every step that
+	// needs neighbour gravity
+	int m_gravityGridCount = 0;
+	std::vector<std::pair<int, int>> m_gravityPairs;
+	float m_gravityCutoff = GRAV_EFFECT_DISTANCE;
+	// Unique broad phase pairs by id, reused every step
+	std::vector<std::pair<int, int>> m_candidatePairs;
+
+	ParticleStore m_particles;
+	// Colliding pairs by slot in candidate order, found per thread and
+	// concatenated in thread order
+	std::vector<std::pair<int, int>> m_mergePairs;
+	std::vector<std::pair<int, int>> m_contactPairs;
+	std::vector<std::vector<std::pair<int, int>>> m_threadMerges;
+	std::vector<std::vector<std::pair<int, int>>> m_threadContacts;
+	// Contact pairs regrouped into batches that share no particle,
+	// batch c is [m_contactBatches[c], m_contactBatches[c + 1]) and the
+	// last batch holds the pairs that ran out of colors
+	std::vector<std::pair<int, int>> m_coloredContacts;
+	std::vector<int> m_contactBatches;
+	std::vector<std::uint64_t> m_contactColors;	// batches taken by each slot
+	std::vector<int> m_pairColors;
+	std::vector<int> m_batchCursors;
+	int m_contactIterations = CONTACT_ITERATIONS;
+	// Merge groups and their (root, slot) members
+	DisjointSet m_mergeSets;
+	std::vector<std::pair<int, int>> m_mergeMembers;
+	// Ids merged away this step, removed from the store after collisions
+	std::vector<int> m_removedIds;
+	std::vector<unsigned char> m_merged;
+
+	GravitySolver m_gravitySolver = GravitySolver::DIRECT;
+	Integrator m_integrator = Integrator::LEAPFROG;
+	// Block steps keep the end of step accelerations in the store, they
+	// are stale after particles are created or merged, or the integrator,
+	// gravity solver or solver parameters change
+	bool m_blockForcesValid = false;
+	std::vector<int> m_blockLevels;
+	std::vector<int> m_blockActive;
+	std::vector<unsigned char> m_blockScratch;
+	BarnesHut m_barnesHut;
+	FastMultipole m_multipole;
+	ParticleMesh m_particleMesh;
+	GravityKernel m_gravityKernel;
+
+	bool m_gridAutoTune = true;
+	int m_stepCount = 0;
+	std::vector<float> m_radiusScratch;
 
-	std::map<int, Particle> m_particles;
-	Manifold m_manifold;
+	std::unique_ptr<ThreadPool> m_pool;
+	// One force buffer per thread, reduced in thread order for determinism
+	std::vector<std::vector<float>> m_threadFx;
+	std::vector<std::vector<float>> m_threadFy;
 	int m_size;
-	int m_idCount = 0;
+
+	Instrumentation m_instrumentation;
 
 	Vec2f potentialEnergy;
 	Vec2f kineticEnergy;
@@ -45,25 +172,327 @@ public:
 
 	void update(float deltaTime);
 
-	Particle& createParticle(const Vec2f& startPos, const Vec2f& startVel);
+	Particle createParticle(const Vec2f& startPos, const Vec2f& startVel);
+
+	Particle createParticle(const Vec2f& startPos, const Vec2f& startVel, float mass, float radius);
+
+	/*
+	* Create count particles from particles in one pass. Storage grows
+	* once, ids are the lowest free ones and so a contiguous range when
+	* none were removed, and the grid takes every new client in one pass.
+	* @return slot of the first new particle, the others follow it until
+	* the next particle is removed
+	*/
+	int createParticles(const ParticleDesc* particles, int count);
 
-	Particle& createParticle(const Vec2f& startPos, const Vec2f& startVel, float mass, float radius);
+	/*
+	* Create count particles described by generate(i, desc), which fills a
+	* default ParticleDesc for the i-th new particle. With parallel the
+	* calls are spread over the thread pool in any order, generate must
+	* then only depend on i and be safe to call concurrently.
+	* @return slot of the first new particle, see above
+	*/
+	template <typename Generate>
+	int createParticles(int count, Generate generate, bool parallel = false);
 
-	const std::map<int, Particle>& getParticles() const { return m_particles; }
-	Particle& getParticleByID(int id)					{ return m_particles[id]; }
+	ParticleRange getParticles()						{ return ParticleRange(&m_particles); }
+	Particle getParticleByID(int id)					{ return Particle(&m_particles, id); }
 	int& size()											{ return m_size; }
 
+	/*
+	* Raw particle arrays for solvers and tools that work on whole arrays
+	*/
+	const ParticleStore& getStore() const				{ return m_particles; }
+
+	/*
+	* Steps taken since the universe was created or its snapshot was taken
+	*/
+	int getStepCount() const							{ return m_stepCount; }
+
+	/*
+	* Write the particle arrays in fields, the id count, step count, the
+	* collision grid and the solver settings to path, see Snapshot.h.
+	* Ids are always written.
+	* @return false if the file could not be written
+	*/
+	bool saveSnapshot(const std::string& path, std::uint32_t fields = SNAPSHOT_ALL) const;
+
+	/*
+	* Restore a snapshot written by saveSnapshot. A snapshot with every
+	* field replaces all particles, a partial one is only applied over the
+	* same ids in the same slots and leaves the other fields alone.
+	* @return false and leaves the universe untouched if the file is not
+	* a valid snapshot or a partial one does not match
+	*/
+	bool loadSnapshot(const std::string& path);
+
+	/*
+	* Choose how the collision grid is maintained. REBUILD suits scenes
+	* where nearly every particle changes cell each step.
+	*/
+	void setGridMode(GridMode mode)						{ m_collisionGrid.setMode(mode); }
+
+	/*
+	* Retune collision cell size from the radius distribution every
+	* GRID_RETUNE_INTERVAL steps, on by default
+	*/
+	void setGridAutoTune(bool enabled)					{ m_gridAutoTune = enabled; }
+	bool getGridAutoTune() const						{ return m_gridAutoTune; }
+
+	/*
+	* Number of threads used by the force phase, 1 runs everything on the
+	* calling thread. Results only depend on the thread count.
+	*/
+	void setThreadCount(int threads);
+	int getThreadCount() const							{ return m_pool->size(); }
+
+	/*
+	* Instruction set of the direct sum kernel. Defaults to the widest the
+	* cpu supports, unsupported levels fall back to a narrower one.
+	*/
+	void setSimdLevel(SimdLevel level)					{ m_gravityKernel.setLevel(level); }
+	SimdLevel getSimdLevel() const						{ return m_gravityKernel.getLevel(); }
+
+	void setGravitySolver(GravitySolver solver)			{ m_gravitySolver = solver; m_blockForcesValid = false; }
+	GravitySolver getGravitySolver() const				{ return m_gravitySolver; }
+
+	void setIntegrator(Integrator integrator)			{ m_integrator = integrator; m_blockForcesValid = false; }
+	Integrator getIntegrator() const					{ return m_integrator; }
+
+	/*
+	* Opening angle of Barnes-Hut, smaller is more accurate and slower
+	*/
+	void setBarnesHutTheta(float theta)					{ m_barnesHut.setTheta(theta); m_blockForcesValid = false; }
+	float getBarnesHutTheta() const						{ return m_barnesHut.getTheta(); }
+
+	/*
+	* Expansion order and opening criterion of the FMM solver, higher
+	* order or smaller theta is more accurate and slower
+	*/
+	void setMultipoleOrder(int order)					{ m_multipole.setOrder(order); m_blockForcesValid = false; }
+	int getMultipoleOrder() const						{ return m_multipole.getOrder(); }
+	void setMultipoleTheta(float theta)					{ m_multipole.setTheta(theta); m_blockForcesValid = false; }
+	float getMultipoleTheta() const						{ return m_multipole.getTheta(); }
+
+	/*
+	* Cells along the longer side of the particle mesh. P3M only keeps the
+	* gravity cutoff while cells are small enough to resolve the split,
+	* coarser meshes widen the short range neighbourhood.
+	*/
+	void setMeshSize(int cells)							{ m_particleMesh.setMeshSize(cells); m_blockForcesValid = false; }
+	int getMeshSize() const								{ return m_particleMesh.getMeshSize(); }
+
+	/*
+	* Neighbour distance of CUTOFF gravity and the P3M short range part
+	*/
+	void setGravityCutoff(float cutoff)
+	{
+		m_gravityCutoff = cutoff > 0.f ? cutoff : GRAV_EFFECT_DISTANCE;
+		m_blockForcesValid = false;
+	}
+	float getGravityCutoff() const						{ return m_gravityCutoff; }
+
+	/*
+	* Contact solver passes per step. Later passes redo the manifolds so
+	* stacked contacts pushed into each other by earlier ones separate.
+	*/
+	void setContactIterations(int iterations)			{ m_contactIterations = iterations > 0 ? iterations : 1; }
+	int getContactIterations() const					{ return m_contactIterations; }
+
+	/*
+	* Solver names used by the command line runners
+	*/
+	static const char* gravitySolverName(GravitySolver solver);
+	static bool parseGravitySolver(const std::string& name, GravitySolver& solver);
+
+	/*
+	* Integrator names used by the command line runners
+	*/
+	static const char* integratorName(Integrator integrator);
+	static bool parseIntegrator(const std::string& name, Integrator& integrator);
+
+	/*
+	* Compare the selected solver against exact applyGravity sums for
+	* the current state without changing any particle.
+	* @return RMS force error relative to the RMS exact force
+	*/
+	float checkGravityAccuracy();
+
+	/*
+	* Per phase timings of the most recent update, zero when built
+	* without PARTICLES_INSTRUMENTATION
+	*/
+	const StepTimings& getLastStepTimings() const		{ return m_instrumentation.last().time; }
+
+	/*
+	* Timings and counters of the most recent update
+	*/
+	const StepStats& getLastStepStats() const			{ return m_instrumentation.last(); }
+
+	/*
+	* Rolling history of step stats
+	*/
+	const Instrumentation& getInstrumentation() const	{ return m_instrumentation; }
+	void dumpInstrumentation(std::ostream& out) const	{ m_instrumentation.dump(out); }
+
 	const SpatialHashGrid& getCollisionGrid() const		{ return m_collisionGrid; }
 	const SpatialHashGrid& getGravityGrid() const		{ return m_gravityGrid; }
 
 private:
-	void applyCoalescence(Particle& a, Particle& b);
+	// Pair functions below take store slots, not ids
+
+	/*
+	* Sort the candidate pairs that touch into m_mergePairs and
+	* m_contactPairs, split across the pool
+	*/
+	void findContacts();
+
+	/*
+	* Merge every group of particles joined by m_mergePairs into its
+	* heaviest member and mark the others for removal. Groups come from
+	* union-find so chains of pairs merge in one go, the result does not
+	* depend on the pair order.
+	*/
+	void resolveCoalescence();
+
+	/*
+	* Greedily color m_contactPairs in order so no two pairs of a batch
+	* share a particle, pairs with a merged particle are dropped
+	*/
+	void colorContacts();
+
+	/*
+	* Apply impulses to the colored contacts for every iteration. Batches
+	* run one after another, pairs within one are split across the pool
+	* and touch disjoint particles so the result does not depend on the
+	* thread count.
+	*/
+	void solveContacts();
+
+	void applyImpulse(int a, int b, const  Manifold& m);
+
+	void applyGravity(int a, int b);
+
+	void applyDirectGravity();
+
+	/*
+	* Symmetric direct sum split across the thread pool in row blocks.
+	* Every thread accumulates into its own buffer which are then summed.
+	*/
+	void applyParallelGravity();
+
+	/*
+	* Forces between slot a and every slot after it into fx, fy
+	*/
+	void applyGravityRow(int a, float* fx, float* fy) const;
+
+	void applyBarnesHutGravity();
+
+	void applyMultipoleGravity();
+
+	/*
+	* Mesh forces, plus short range pair forces in P3M mode
+	*/
+	void applyParticleMeshGravity();
 
-	void applyImpulse(Particle& a, Particle& b, const  Manifold& m);
+	/*
+	* Part of the force the mesh leaves out between slots closer than the
+	* mesh cutoff
+	*/
+	void applyShortRangeGravity();
 
-	void applyGravity(Particle& a, Particle& b);
+	/*
+	* Switched gravity between slots closer than the gravity cutoff only
+	*/
+	void applyCutoffGravity();
 
-	bool particlesColliding(Particle& a, Particle& b, Manifold& m);
+	/*
+	* Fill m_gravityPairs with every slot pair that may be within cutoff
+	*/
+	void findGravityPairs(float cutoff);
+
+	/*
+	* Forces for m_gravityPairs closer than cutoff, scaled by the P3M short
+	* range factor when split is set and by gravitySwitch otherwise.
+	* Threads sum pair chunks into their own buffers.
+	*/
+	void applyPairGravity(float cutoff, float split);
+
+	/*
+	* Force scale of CUTOFF gravity at distance r
+	*/
+	static float gravitySwitch(float r, float cutoff);
+
+	/*
+	* Add gravity from the selected solver to the store forces
+	*/
+	void applySolverGravity();
+
+	/*
+	* Advance positions and velocities by deltaTime with the selected
+	* integrator, evaluating gravity as often as it needs
+	*/
+	void integrate(float deltaTime);
+
+	/*
+	* Kick drift kick with per particle steps of deltaTime / 2^level. Levels
+	* come from BLOCK_ETA times the longer of |v| / |a| and
+	* sqrt(radius / |a|) at the start of the step, the second keeps
+	* particles at rest from dropping to the finest level.
+	*/
+	void integrateBlocks(float deltaTime);
+
+	/*
+	* Gravity from the selected solver into empty store forces
+	*/
+	void evaluateGravity();
+
+	/*
+	* Gravity on the slots in targets only. DIRECT and BARNES_HUT only do
+	* work for targets, other solvers evaluate everything and the forces
+	* of other slots are cleared.
+	*/
+	void evaluateGravity(const std::vector<int>& targets);
+
+	/*
+	* Velocities from the current forces over step, which are then cleared
+	*/
+	void kick(float step);
+
+	/*
+	* Positions from the current velocities over step
+	*/
+	void drift(float step);
+
+	bool particlesColliding(int a, int b, Manifold& m);
+
+	/*
+	* Drop particles merged away during collisions from the store
+	*/
+	void removeMergedParticles();
+
+	/*
+	* Size collision cells to GRID_CELL_TO_RADIUS times the
+	* GRID_RADIUS_PERCENTILE radius so most particles cover few cells,
+	* bigger bodies land in the grid's large object list
+	*/
+	void retuneCollisionGrid();
+
+	/*
+	* Append count default particles for createParticles
+	* @return slot of the first
+	*/
+	int addParticles(int count);
+
+	/*
+	* Write desc over the particle in slot
+	*/
+	void setParticle(int slot, const ParticleDesc& desc);
+
+	/*
+	* Add the count particles from slot first to the collision grid
+	*/
+	void addClients(int first, int count);
 
 
 	// TODO : potential too many calculations
@@ -74,5 +503,26 @@ private:
 	Vec2f sumKineticEnergies() const;
 };
 
+template <typename Generate>
+int Universe::createParticles(int count, Generate generate, bool parallel)
+{
+	int first = addParticles(count);
+	auto fill = [&](int, int from, int to)
+	{
+		for (int i = from; i < to; i++)
+		{
+			ParticleDesc desc;
+			generate(i, desc);
+			setParticle(first + i, desc);
+		}
+	};
+	if (parallel)
+		m_pool->parallelFor(0, count, fill);
+	else
+		fill(0, 0, count);
+	addClients(first, count);
+	return first;
+}
+
 #endif // !UNIVERSE_H
 
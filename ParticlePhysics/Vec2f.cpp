@@ -6,6 +6,8 @@
 
 #include "Vec2f.h"
 #include <cmath>
+#include <cfloat>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 